@@ -0,0 +1,109 @@
+#ifndef __BITOPS_H__
+#define __BITOPS_H__
+
+#include "type.h"
+
+/* 一个寄存器的位数,位图按照寄存器大小的字来操作,RV64每个字64位,RV32每个字32位 */
+#define BITS_PER_REG (sizeof(reg_t) * 8)
+
+/* 位图中第nr位所在的字和字内的掩码 */
+#define BIT_WORD(nr) ((nr) / BITS_PER_REG)
+#define BIT_MASK(nr) ((reg_t)1 << ((nr) % BITS_PER_REG))
+
+/*
+ * 计算x末尾0的个数,x不能为0
+ * 没有Zbb扩展就没有ctz指令,而-nostdlib也不能调用libgcc的__ctzdi2
+ * 所以用de Bruijn序列来算: x & -x只保留最低位的1,乘以de Bruijn常数后高几位就是唯一的下标
+ */
+static inline int ctz(reg_t x)
+{
+#ifdef RV32
+    static const uint8_t table[32] = {
+        0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+        31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return table[((x & -x) * 0x077CB531U) >> 27];
+#else
+    static const uint8_t table[64] = {
+        0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+        62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+        63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+        51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+    };
+    return table[((x & -x) * 0x022FDD63CC95386DULL) >> 58];
+#endif
+}
+
+/*
+ * 计算x最高位的1的下标,即BITS_PER_REG - 1 - clz(x),x不能为0
+ * 先把最高位的1往低位全部填满,再异或右移一位的结果,就只剩下最高位的1,然后用ctz求下标
+ */
+static inline int fls(reg_t x)
+{
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+#ifndef RV32
+    x |= x >> 32;
+#endif
+    return ctz(x ^ (x >> 1));
+}
+
+/* 位图操作 */
+static inline int test_bit(reg_t *map, reg_t nr)
+{
+    return (map[BIT_WORD(nr)] & BIT_MASK(nr)) ? 1 : 0;
+}
+
+static inline void set_bit(reg_t *map, reg_t nr)
+{
+    map[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(reg_t *map, reg_t nr)
+{
+    map[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+/*
+ * 从第pos位开始往后找第一个为1的位,位图共size位,找不到返回size
+ * 整个字为0就直接跳过,字内用ctz找,所以是按字而不是按位扫描
+ */
+static inline reg_t find_next_bit(reg_t *map, reg_t size, reg_t pos)
+{
+    if(pos >= size)
+        return size;
+    reg_t idx = BIT_WORD(pos);
+    // 去掉pos之前的位
+    reg_t word = map[idx] & (~(reg_t)0 << (pos % BITS_PER_REG));
+    while(word == 0)
+    {
+        if(++idx * BITS_PER_REG >= size)
+            return size;
+        word = map[idx];
+    }
+    pos = idx * BITS_PER_REG + ctz(word);
+    return pos < size ? pos : size;
+}
+
+/*
+ * 从第pos位开始往前找第一个为1的位,找不到返回(reg_t)-1
+ * 同样按字跳过全0的字,字内用fls找
+ */
+static inline reg_t find_prev_bit(reg_t *map, reg_t pos)
+{
+    reg_t idx = BIT_WORD(pos);
+    // 去掉pos之后的位
+    reg_t word = map[idx] & (~(reg_t)0 >> (BITS_PER_REG - 1 - pos % BITS_PER_REG));
+    while(word == 0)
+    {
+        if(idx == 0)
+            return (reg_t)-1;
+        word = map[--idx];
+    }
+    return idx * BITS_PER_REG + fls(word);
+}
+
+#endif
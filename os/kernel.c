@@ -1,21 +1,31 @@
 #include "os.h"
 
-extern struct taskInfo *first_task;
+/* hart 0完成全局初始化后置1,其他hart等到这时才开始初始化自己的trap、定时器和调度 */
+static volatile int _started = 0;
 
 void start_kernel(void) {
     // 打印串口初始化
     uart_init();
+    printf_init();
     printf("Hello XinOS\n");
     // 内存管理初始化
     page_init();
+#ifdef CONFIG_BENCH
+    malloc_bench();
+#endif
     // trap初始化
     trap_init();
     // plic初始化
     plic_init();
-    // 硬件定时器初始化
-    timer_init();
     // 任务调度初始化
     sched_init();
+    // futex的等待队列初始化,用户任务运行之前完成
+    futex_init();
+    // 硬件定时器初始化,会创建执行定时器回调的内核线程,所以放在sched_init之后
+    timer_init();
+    // 放行其他hart,前面初始化的数据要在_started置1之前对其他hart可见
+    __sync_synchronize();
+    _started = 1;
     // 返回到内核执行
     // 这里如果不执行该语句,直接执行kernel函数的话,当走到内核去调起第一个用户任务时
     // 由于mscratch寄存器此时为0,不会保存当前运行的内核任务寄存器
@@ -28,25 +38,38 @@ void start_kernel(void) {
     printf("Never Be Here!!!");
 }
 
+/* 除hart 0之外的其他hart的入口,在start.S中跳转过来 */
+void start_hart(void)
+{
+    while(_started == 0)
+        ;
+    __sync_synchronize();
+    printf("hart %d started\n", r_mhartid());
+    // 每个hart都有自己的mtvec、mtimecmp、mscratch和plic context,需要各自初始化
+    trap_init();
+    timer_init_hart();
+    sched_init_hart();
+    // plic_init会打开全局中断,所以放在最后
+    plic_init();
+    back_os();
+
+    printf("Never Be Here!!!");
+}
+
 /* 内核任务函数 */
 void kernel()
 {
-    // 创建用户任务
-    user_init();
+    // 创建用户任务,只由hart 0创建一次,任务先放入hart 0的就绪队列,空闲的hart再从中偷取
+    if(r_mhartid() == 0)
+        user_init();
 
     // 内核任务开始
     while (1)
     {
-        //printf("======== OS Starts Next User's Task =====\n");
-        // 开启其中一个用户任务,这样hart就会去执行用户任务,而不会去执行下面的内核语句了
-
-        // 直接调用schedule函数会由于没有保存os的新的上下文pc而导致出现一直走kernel函数
-        // 在sched_init中设置了os_task的pc为kernel,直接调用schedule函数不会调用reg_store保存此时的pc
-        // 而是继续使用旧上下文的pc,也就是kernel函数,那么就会重复创建同一个user task
+        // 有就绪任务就切换过去,hart就会去执行用户任务,而不会去执行下面的内核语句了
+        // 没有的话schedule会回到内核任务,从这里返回
         task_yield();
-
-        //printf("===== BACK 2 OS =====\n");
-        //task_delay(10000);
-        // schedule();
+        // 没有任务可运行,wfi等待中断,被唤醒后再次调度
+        cpu_idle();
     }
-}
\ No newline at end of file
+}
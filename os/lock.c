@@ -1,30 +1,1050 @@
 #include "os.h"
 
-void lock_init(lock_t *lock)
+#ifdef CONFIG_LOCKSTAT
+/* 所有带统计的锁,初始化时用CAS插到链表头,不需要锁 */
+static struct lock_stat *volatile _lockstat_list = NULL;
+
+/* 清零统计并挂到全局链表上,同一个锁再次初始化时不会重复插入 */
+static void _lockstat_init(struct lock_stat *st, char *name)
+{
+    st->name = name;
+    st->acquisitions = 0;
+    st->contended = 0;
+    st->wait_total = 0;
+    st->wait_max = 0;
+    st->hold_total = 0;
+    st->hold_max = 0;
+    st->read_acquisitions = 0;
+    st->read_contended = 0;
+    st->read_wait_total = 0;
+    st->read_wait_max = 0;
+    st->read_busy = 0;
+    if(st->registered)
+        return;
+    st->registered = 1;
+    do
+    {
+        st->next = _lockstat_list;
+    } while(!__sync_bool_compare_and_swap(&_lockstat_list, st->next, st));
+}
+
+/* 获取成功后调用,start为开始获取时的mtime */
+static void _lockstat_acquired(struct lock_stat *st, uint64_t start, int contended)
+{
+    uint64_t now = timer_mtime();
+    uint64_t wait = now - start;
+    st->acquisitions++;
+    if(contended)
+        st->contended++;
+    st->wait_total += wait;
+    if(wait > st->wait_max)
+        st->wait_max = wait;
+    st->hold_start = now;
+}
+
+/*
+ * 读者获取成功后调用,acquired为0时只记录一次竞争(顺序锁的重读)
+ * 多个读者会同时更新,用read_busy互斥,关中断防止持有read_busy时被切换走
+ */
+static void _lockstat_read_acquired(struct lock_stat *st, uint64_t start, int acquired, int contended)
+{
+    uint64_t wait = timer_mtime() - start;
+    push_off();
+    while(__sync_lock_test_and_set(&st->read_busy, 1) != 0)
+        ;
+    if(acquired)
+    {
+        st->read_acquisitions++;
+        st->read_wait_total += wait;
+        if(wait > st->read_wait_max)
+            st->read_wait_max = wait;
+    }
+    if(contended)
+        st->read_contended++;
+    __sync_lock_release(&st->read_busy);
+    pop_off();
+}
+
+/* 释放之前调用 */
+static void _lockstat_release(struct lock_stat *st)
 {
-    lock->locked = 0;
+    uint64_t hold = timer_mtime() - st->hold_start;
+    st->hold_total += hold;
+    if(hold > st->hold_max)
+        st->hold_max = hold;
 }
 
-/* 在单hart抢占式系统中,死锁发生在中断任务切换时,所以粗暴的办法就是将中断关闭 */
-void basic_lock()
+/*
+ * 打印所有获取过的锁的统计,同名的锁(例如每个hart的rq)各打印一行
+ * RV64下long是64位,直接打印CLINT时钟数;RV32下printf最多32位,换算成微秒,累计超过约35分钟才会溢出
+ */
+void lockstat_print()
 {
-    w_mstatus(r_mstatus() & ~MSTATUS_MIE);
+#ifdef RV32
+    printf("lockstat: name acquisitions contended wait-total wait-max hold-total hold-max (us)\n");
+    for(struct lock_stat *st = _lockstat_list; st != NULL; st = st->next)
+    {
+        if(st->acquisitions == 0)
+            continue;
+        printf("%s %d %d %d %d %d %d\n", st->name, st->acquisitions, st->contended,
+            (int)timer_mtime_to_us(st->wait_total), (int)timer_mtime_to_us(st->wait_max),
+            (int)timer_mtime_to_us(st->hold_total), (int)timer_mtime_to_us(st->hold_max));
+    }
+    for(struct lock_stat *st = _lockstat_list; st != NULL; st = st->next)
+    {
+        if(st->read_acquisitions == 0)
+            continue;
+        printf("%s (read) %d %d %d %d\n", st->name, st->read_acquisitions, st->read_contended,
+            (int)timer_mtime_to_us(st->read_wait_total), (int)timer_mtime_to_us(st->read_wait_max));
+    }
+#else
+    printf("lockstat: name acquisitions contended wait-total wait-max hold-total hold-max (cycles)\n");
+    for(struct lock_stat *st = _lockstat_list; st != NULL; st = st->next)
+    {
+        if(st->acquisitions == 0)
+            continue;
+        printf("%s %d %d %ld %ld %ld %ld\n", st->name, st->acquisitions, st->contended,
+            (long)st->wait_total, (long)st->wait_max, (long)st->hold_total, (long)st->hold_max);
+    }
+    for(struct lock_stat *st = _lockstat_list; st != NULL; st = st->next)
+    {
+        if(st->read_acquisitions == 0)
+            continue;
+        printf("%s (read) %d %d %ld %ld\n", st->name, st->read_acquisitions, st->read_contended,
+            (long)st->read_wait_total, (long)st->read_wait_max);
+    }
+#endif
 }
 
-/* 粗暴的释放锁 */
-void basic_unlock()
+#define lockstat_now() timer_mtime()
+#define lockstat_init(st, name) _lockstat_init(st, name)
+#define lockstat_acquired(st, start, contended) _lockstat_acquired(st, start, contended)
+#define lockstat_release(st) _lockstat_release(st)
+#define lockstat_read_acquired(st, start, acquired, contended) _lockstat_read_acquired(st, start, acquired, contended)
+#else
+#define lockstat_now() 0
+#define lockstat_init(st, name)
+#define lockstat_acquired(st, start, contended) ((void)(start), (void)(contended))
+#define lockstat_release(st)
+#define lockstat_read_acquired(st, start, acquired, contended) ((void)(start), (void)(contended))
+#endif
+
+/*
+ * 票据锁的获取和释放,调用方负责关中断
+ * 取号用amoadd.w,不需要排序;等到自己的号之后fence r, rw,保证临界区中的读写不会被提前到看到owner之前(acquire)
+ * 释放时先fence rw, w,保证临界区中的读写都在owner加1之前完成(release),只有持有者会写owner,所以不需要原子指令
+ * 取到号时还没轮到自己说明有竞争,返回1
+ */
+static int _ticket_acquire(volatile uint32_t *next, volatile uint32_t *owner)
 {
-    w_mstatus(r_mstatus() | MSTATUS_MIE);
+    uint32_t ticket;
+    asm volatile("amoadd.w %0, %1, (%2)" : "=r"(ticket) : "r"(1), "r"(next) : "memory");
+    int contended = *owner != ticket;
+    while(*owner != ticket)
+        ;
+    asm volatile("fence r, rw" ::: "memory");
+    return contended;
 }
 
-/* 自旋锁,尝试获取锁状态并加锁 */
+static void _ticket_release(volatile uint32_t *owner)
+{
+    asm volatile("fence rw, w" ::: "memory");
+    *owner = *owner + 1;
+}
+
+void lock_init(lock_t *lock)
+{
+    lock->next = 0;
+    lock->owner = 0;
+    lockstat_init(&lock->stat, "lock_t");
+}
+
+/* 获取票据锁,关中断,持有期间不会被抢占,代替原来直接开关MIE的basic_lock */
 void lock_acquire(lock_t *lock)
 {
-    while(atomic_swap(lock));
+    push_off();
+    uint64_t start = lockstat_now();
+    int contended = _ticket_acquire(&lock->next, &lock->owner);
+    lockstat_acquired(&lock->stat, start, contended);
 }
 
-/* 自旋锁,释放锁 */
+/* 释放票据锁,恢复到最外层lock_acquire之前的中断状态 */
 void lock_free(lock_t *lock)
 {
-    lock->locked = 0;
-}
\ No newline at end of file
+    lockstat_release(&lock->stat);
+    _ticket_release(&lock->owner);
+    pop_off();
+}
+
+/* 原子地把*p换成v并返回旧值,aqrl使前后的读写都不会越过它 */
+static struct mcs_node *_mcs_swap(struct mcs_node *volatile *p, struct mcs_node *v)
+{
+    struct mcs_node *old;
+#ifdef RV32
+    asm volatile("amoswap.w.aqrl %0, %1, (%2)" : "=r"(old) : "r"(v), "r"(p) : "memory");
+#else
+    asm volatile("amoswap.d.aqrl %0, %1, (%2)" : "=r"(old) : "r"(v), "r"(p) : "memory");
+#endif
+    return old;
+}
+
+/* 用lr/sc实现的比较并交换,*p等于old时换成v,成功返回1 */
+static int _mcs_cas(struct mcs_node *volatile *p, struct mcs_node *old, struct mcs_node *v)
+{
+    struct mcs_node *cur;
+    reg_t fail;
+#ifdef RV32
+    asm volatile(
+        "1: lr.w.aqrl %0, (%2)\n"
+        "   bne %0, %3, 2f\n"
+        "   sc.w.rl %1, %4, (%2)\n"
+        "   bnez %1, 1b\n"
+        "2:"
+        : "=&r"(cur), "=&r"(fail) : "r"(p), "r"(old), "r"(v) : "memory");
+#else
+    asm volatile(
+        "1: lr.d.aqrl %0, (%2)\n"
+        "   bne %0, %3, 2f\n"
+        "   sc.d.rl %1, %4, (%2)\n"
+        "   bnez %1, 1b\n"
+        "2:"
+        : "=&r"(cur), "=&r"(fail) : "r"(p), "r"(old), "r"(v) : "memory");
+#endif
+    return cur == old;
+}
+
+void mcs_init(struct mcs_lock *lk)
+{
+    lk->tail = NULL;
+    lockstat_init(&lk->stat, "mcs");
+}
+
+/* 获取MCS锁,把node接到队尾,前面有等待者的话就在node->locked上自旋,直到前一个持有者释放时清零 */
+void mcs_lock(struct mcs_lock *lk, struct mcs_node *node)
+{
+    push_off();
+    uint64_t start = lockstat_now();
+    node->next = NULL;
+    node->locked = 1;
+    struct mcs_node *prev = _mcs_swap(&lk->tail, node);
+    if(prev != NULL)
+    {
+        prev->next = node;
+        while(node->locked)
+            ;
+        asm volatile("fence r, rw" ::: "memory");
+    }
+    lockstat_acquired(&lk->stat, start, prev != NULL);
+}
+
+/*
+ * 释放MCS锁,没有后继时把tail清空;tail已经不是自己的话,说明后继刚换到队尾还没有链接上来,等它链接好
+ * 然后fence rw, w之后清除后继的locked,把锁交给它
+ */
+void mcs_unlock(struct mcs_lock *lk, struct mcs_node *node)
+{
+    lockstat_release(&lk->stat);
+    if(node->next == NULL)
+    {
+        if(_mcs_cas(&lk->tail, node, NULL))
+        {
+            pop_off();
+            return;
+        }
+        while(node->next == NULL)
+            ;
+    }
+    asm volatile("fence rw, w" ::: "memory");
+    node->next->locked = 0;
+    pop_off();
+}
+
+/*
+ * 关闭当前hart的中断,可以嵌套调用,只有最外层的pop_off才会恢复中断
+ * 第一次调用时记录中断原来是否打开,这样在trap中(中断本来就是关闭的)调用也不会错误地打开中断
+ */
+void push_off()
+{
+    reg_t mstatus = r_mstatus();
+    w_mstatus(mstatus & ~MSTATUS_MIE);
+    struct cpu *c = mycpu();
+    if(c->noff == 0)
+    {
+        c->intena = (mstatus & MSTATUS_MIE) != 0;
+        if(c->intena)
+            irqoff_begin();
+    }
+    c->noff++;
+}
+
+void pop_off()
+{
+    struct cpu *c = mycpu();
+    if(r_mstatus() & MSTATUS_MIE)
+        panic("pop_off: interruptible");
+    if(c->noff < 1)
+        panic("pop_off: unbalanced");
+    c->noff--;
+    if(c->noff == 0 && c->intena)
+    {
+        irqoff_end();
+        w_mstatus(r_mstatus() | MSTATUS_MIE);
+    }
+}
+
+void spin_init(struct spinlock *lk, char *name)
+{
+    lk->next = 0;
+    lk->owner = 0;
+    lk->name = name;
+    lk->cpu = -1;
+    lockstat_init(&lk->stat, name);
+}
+
+/* 判断当前hart是否持有该锁,需要在关中断时调用,owner不等于next说明锁被持有 */
+int spin_holding(struct spinlock *lk)
+{
+    return lk->owner != lk->next && lk->cpu == (int)r_mhartid();
+}
+
+/* 获取内核自旋锁,按取号的顺序获取 */
+void spin_lock(struct spinlock *lk)
+{
+    push_off();
+    if(spin_holding(lk))
+        panic("spin_lock: already holding");
+    uint64_t start = lockstat_now();
+    int contended = _ticket_acquire(&lk->next, &lk->owner);
+    lk->cpu = r_mhartid();
+    lockstat_acquired(&lk->stat, start, contended);
+}
+
+/* 释放内核自旋锁 */
+void spin_unlock(struct spinlock *lk)
+{
+    if(!spin_holding(lk))
+        panic("spin_unlock: not holding");
+    lockstat_release(&lk->stat);
+    lk->cpu = -1;
+    _ticket_release(&lk->owner);
+    pop_off();
+}
+
+void wait_queue_init(struct wait_queue *wq, char *name)
+{
+    spin_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->tail = &wq->head;
+}
+
+/* 把任务从等待队列中摘下,需要持有wq->lock,等待的任务一般不多,直接遍历 */
+static void _wait_remove(struct wait_queue *wq, struct taskInfo *task)
+{
+    struct taskInfo **pp = &wq->head;
+    while(*pp != task)
+        pp = &(*pp)->wait_next;
+    *pp = task->wait_next;
+    if(wq->tail == &task->wait_next)
+        wq->tail = pp;
+    task->wait_next = NULL;
+    task->wait_on = NULL;
+}
+
+/* 把当前任务加到等待队列末尾并设置为阻塞状态,需要持有wq->lock */
+static void _wait_add(struct wait_queue *wq, struct taskInfo *task)
+{
+    if(task->wait_on == NULL)
+    {
+        task->wait_next = NULL;
+        *wq->tail = task;
+        wq->tail = &task->wait_next;
+        task->wait_on = wq;
+    }
+    task_set_blocked();
+}
+
+/*
+ * 开始等待,当前任务进入等待队列并设置为阻塞状态,之后再检查条件
+ * 检查条件之后、task_yield之前被wake_up的话任务已经是就绪状态,task_yield之后马上会再运行,唤醒不会丢失
+ */
+void wait_prepare(struct wait_queue *wq)
+{
+    struct taskInfo *task = task_self();
+    spin_lock(&wq->lock);
+    _wait_add(wq, task);
+    spin_unlock(&wq->lock);
+}
+
+/* 结束等待,恢复运行状态,还没有被唤醒(条件已经满足或者被抢占后又运行了)的话从等待队列中摘下 */
+void wait_finish(struct wait_queue *wq)
+{
+    struct taskInfo *task = task_self();
+    task_set_running();
+    spin_lock(&wq->lock);
+    if(task->wait_on == wq)
+        _wait_remove(wq, task);
+    spin_unlock(&wq->lock);
+}
+
+/* 按等待的先后顺序唤醒最多n个任务,n小于等于0时全部唤醒,返回唤醒的个数 */
+int wake_up(struct wait_queue *wq, int n)
+{
+    struct taskInfo *head = NULL;
+    struct taskInfo **tail = &head;
+    int cnt = 0;
+    // 持锁时只把要唤醒的任务摘下来,释放锁之后再逐个放回就绪队列
+    spin_lock(&wq->lock);
+    while(wq->head != NULL && (n <= 0 || cnt < n))
+    {
+        struct taskInfo *task = wq->head;
+        _wait_remove(wq, task);
+        *tail = task;
+        tail = &task->wait_next;
+        ++cnt;
+    }
+    spin_unlock(&wq->lock);
+    while(head)
+    {
+        // task_wakeup之后任务可能马上运行并再次进入等待队列,所以要先取出下一个
+        struct taskInfo *task = head;
+        head = head->wait_next;
+        task->wait_next = NULL;
+        task_wakeup(task);
+    }
+    return cnt;
+}
+
+void mutex_init(struct mutex *m, char *name)
+{
+    m->locked = 0;
+    m->owner = NULL;
+    // 等待队列的自旋锁也有自己的统计,用不同的名字和互斥锁本身区分开
+    wait_queue_init(&m->wq, "mutex_wq");
+    lockstat_init(&m->stat, name);
+}
+
+static int _mutex_trylock(struct mutex *m)
+{
+    if(__sync_lock_test_and_set(&m->locked, 1) != 0)
+        return 0;
+    m->owner = task_self();
+    return 1;
+}
+
+/*
+ * 持有者正在其他hart上运行时自旋等它释放,获取到返回1
+ * 持有者很快就会释放的话,自旋比阻塞再唤醒少了两次任务切换;单hart时持有者不可能在运行,不会自旋
+ * 持有者的结构体在任务退出后由slab回收但不会还给页分配器,所以这里读到的on_cpu最多是过时的
+ */
+static int _mutex_spin(struct mutex *m)
+{
+    for(int i = 0; i < MUTEX_SPIN_COUNT; ++i)
+    {
+        struct taskInfo *owner = m->owner;
+        if(owner == NULL)
+        {
+            // 释放了,或者刚被获取还没设置owner
+            if(!m->locked && _mutex_trylock(m))
+                return 1;
+            continue;
+        }
+        if(!owner->on_cpu || owner->cpu == (int)r_mhartid())
+            return 0;
+    }
+    return 0;
+}
+
+/*
+ * 获取互斥锁,获取不到时阻塞,直到mutex_unlock把锁交给当前任务,第一次就获取成功返回0,否则返回1
+ * 内核任务不能阻塞,只能自旋
+ */
+static int _mutex_lock(struct mutex *m)
+{
+    if(_mutex_trylock(m))
+        return 0;
+    struct taskInfo *self = task_self();
+    if(self == NULL)
+    {
+        while(!_mutex_trylock(m))
+            ;
+        return 1;
+    }
+    if(_mutex_spin(m))
+        return 1;
+    spin_lock(&m->wq.lock);
+    // mutex_unlock在持有wq.lock时检查等待队列,所以加入队列前再试一次就不会错过释放
+    if(__sync_lock_test_and_set(&m->locked, 1) == 0)
+    {
+        m->owner = self;
+        spin_unlock(&m->wq.lock);
+        return 1;
+    }
+    _wait_add(&m->wq, self);
+    spin_unlock(&m->wq.lock);
+    // 被抢占时阻塞的任务会被放回就绪队列,所以醒来后要检查锁是不是已经交给自己了
+    while(m->owner != self)
+    {
+        task_yield();
+        task_set_blocked();
+        if(m->owner == self)
+            break;
+    }
+    task_set_running();
+    return 1;
+}
+
+void mutex_lock(struct mutex *m)
+{
+    uint64_t start = lockstat_now();
+    int contended = _mutex_lock(m);
+    lockstat_acquired(&m->stat, start, contended);
+}
+
+/* 尝试获取互斥锁,成功返回1 */
+int mutex_trylock(struct mutex *m)
+{
+    uint64_t start = lockstat_now();
+    if(!_mutex_trylock(m))
+        return 0;
+    lockstat_acquired(&m->stat, start, 0);
+    return 1;
+}
+
+/* 释放互斥锁,有等待的任务时locked保持为1,直接把锁交给队头的任务 */
+void mutex_unlock(struct mutex *m)
+{
+    lockstat_release(&m->stat);
+    spin_lock(&m->wq.lock);
+    struct taskInfo *next = m->wq.head;
+    if(next != NULL)
+    {
+        _wait_remove(&m->wq, next);
+        m->owner = next;
+    }
+    else
+    {
+        m->owner = NULL;
+        __sync_lock_release(&m->locked);
+    }
+    spin_unlock(&m->wq.lock);
+    if(next != NULL)
+        task_wakeup(next);
+}
+
+void rwlock_init(rwlock_t *lock, char *name)
+{
+    lock->val = 0;
+    lockstat_init(&lock->stat, name);
+}
+
+/* 获取读锁,没有写者持有也没有写者在等待时读者个数加1,CAS是全屏障,临界区中的读不会提前 */
+void read_lock(rwlock_t *lock)
+{
+    push_off();
+    uint64_t start = lockstat_now();
+    int contended = 0;
+    while(1)
+    {
+        uint32_t old = lock->val;
+        if((old & (RW_WRITER | RW_WAIT)) == 0 && __sync_bool_compare_and_swap(&lock->val, old, old + 1))
+            break;
+        contended = 1;
+    }
+    lockstat_read_acquired(&lock->stat, start, 1, contended);
+}
+
+void read_unlock(rwlock_t *lock)
+{
+    __sync_fetch_and_sub(&lock->val, 1);
+    pop_off();
+}
+
+/* 获取写锁,先置RW_WAIT挡住新的读者,等已有的读者全部退出后换成RW_WRITER */
+void write_lock(rwlock_t *lock)
+{
+    push_off();
+    uint64_t start = lockstat_now();
+    int contended = 0;
+    while(1)
+    {
+        uint32_t old = lock->val;
+        if((old & ~RW_WAIT) == 0)
+        {
+            if(__sync_bool_compare_and_swap(&lock->val, old, RW_WRITER))
+                break;
+        }
+        else if((old & RW_WAIT) == 0)
+        {
+            __sync_bool_compare_and_swap(&lock->val, old, old | RW_WAIT);
+        }
+        contended = 1;
+    }
+    lockstat_acquired(&lock->stat, start, contended);
+}
+
+/* 释放写锁,同时清除RW_WAIT,其他还在等待的写者会重新设置 */
+void write_unlock(rwlock_t *lock)
+{
+    lockstat_release(&lock->stat);
+    __sync_lock_release(&lock->val);
+    pop_off();
+}
+
+void rwsem_init(struct rwsem *sem, char *name)
+{
+    sem->count = 0;
+    sem->writers_waiting = 0;
+    // 和互斥锁一样,等待队列的自旋锁用不同的名字
+    wait_queue_init(&sem->wq, "rwsem_wq");
+    lockstat_init(&sem->stat, name);
+}
+
+/*
+ * 进入等待队列并释放wq.lock,切换走直到被唤醒,醒来后重新持有wq.lock,调用方再检查条件
+ * 被抢占或者在task_yield之前就被唤醒的话会马上返回,所以调用方都要循环检查
+ */
+static void _rwsem_wait(struct rwsem *sem, struct taskInfo *self)
+{
+    _wait_add(&sem->wq, self);
+    spin_unlock(&sem->wq.lock);
+    task_yield();
+    task_set_running();
+    spin_lock(&sem->wq.lock);
+    if(self->wait_on == &sem->wq)
+        _wait_remove(&sem->wq, self);
+}
+
+void down_read(struct rwsem *sem)
+{
+    struct taskInfo *self = task_self();
+    uint64_t start = lockstat_now();
+    int contended = 0;
+    spin_lock(&sem->wq.lock);
+    while(sem->count < 0 || sem->writers_waiting > 0)
+    {
+        _rwsem_wait(sem, self);
+        contended = 1;
+    }
+    sem->count++;
+    spin_unlock(&sem->wq.lock);
+    lockstat_read_acquired(&sem->stat, start, 1, contended);
+}
+
+/* 最后一个读者退出时唤醒等待的任务,被唤醒的写者和读者都会重新检查 */
+void up_read(struct rwsem *sem)
+{
+    spin_lock(&sem->wq.lock);
+    int last = --sem->count == 0;
+    spin_unlock(&sem->wq.lock);
+    if(last)
+        wake_up(&sem->wq, 0);
+}
+
+void down_write(struct rwsem *sem)
+{
+    struct taskInfo *self = task_self();
+    uint64_t start = lockstat_now();
+    int contended = 0;
+    spin_lock(&sem->wq.lock);
+    sem->writers_waiting++;
+    while(sem->count != 0)
+    {
+        _rwsem_wait(sem, self);
+        contended = 1;
+    }
+    sem->writers_waiting--;
+    sem->count = -1;
+    spin_unlock(&sem->wq.lock);
+    lockstat_acquired(&sem->stat, start, contended);
+}
+
+void up_write(struct rwsem *sem)
+{
+    lockstat_release(&sem->stat);
+    spin_lock(&sem->wq.lock);
+    sem->count = 0;
+    spin_unlock(&sem->wq.lock);
+    wake_up(&sem->wq, 0);
+}
+
+void seqlock_init(struct seqlock *sl, char *name)
+{
+    sl->seq = 0;
+    spin_init(&sl->lock, name);
+    lockstat_init(&sl->stat, name);
+}
+
+/* 写者开始修改,seq变为奇数,fence w, w保证seq先于数据写出 */
+void write_seqlock(struct seqlock *sl)
+{
+    spin_lock(&sl->lock);
+    sl->seq++;
+    asm volatile("fence w, w" ::: "memory");
+}
+
+/* 写者修改完成,fence w, w保证数据先于seq写出,seq变回偶数 */
+void write_sequnlock(struct seqlock *sl)
+{
+    asm volatile("fence w, w" ::: "memory");
+    sl->seq++;
+    spin_unlock(&sl->lock);
+}
+
+/* 读者开始读,等到没有写者正在修改,返回当前的seq */
+uint32_t read_seqbegin(struct seqlock *sl)
+{
+    uint64_t start = lockstat_now();
+    int contended = 0;
+    uint32_t seq;
+    while((seq = sl->seq) & 1)
+        contended = 1;
+    asm volatile("fence r, r" ::: "memory");
+    lockstat_read_acquired(&sl->stat, start, 1, contended);
+    return seq;
+}
+
+/* 读者读完,seq变了说明读的过程中有写者修改过,返回1需要重读 */
+int read_seqretry(struct seqlock *sl, uint32_t start)
+{
+    asm volatile("fence r, r" ::: "memory");
+    int retry = sl->seq != start;
+    if(retry)
+        lockstat_read_acquired(&sl->stat, lockstat_now(), 0, 1);
+    return retry;
+}
+
+/*
+ * futex的等待队列,按用户地址散列到FUTEX_HASH_SIZE个队列中,同一个队列中的任务可能在等不同的地址
+ * 等待的地址记录在task->futex_key中,唤醒时只唤醒地址相同的任务
+ */
+#define FUTEX_HASH_SIZE 16
+static struct wait_queue _futex_queues[FUTEX_HASH_SIZE];
+
+void futex_init()
+{
+    for(int i = 0; i < FUTEX_HASH_SIZE; ++i)
+        wait_queue_init(&_futex_queues[i], "futex");
+}
+
+static struct wait_queue *_futex_queue(volatile uint32_t *addr)
+{
+    return &_futex_queues[((reg_t)addr >> 2) & (FUTEX_HASH_SIZE - 1)];
+}
+
+/*
+ * *addr仍然等于val时把当前任务放入等待队列并设置为阻塞状态,返回0,调用方随后需要主动切换;否则返回-1
+ * 比较和入队都在持有等待队列的锁时完成,用户在修改*addr之后调用的FUTEX_WAKE一定能看到这个任务
+ */
+int futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+    struct taskInfo *task = task_self();
+    struct wait_queue *wq = _futex_queue(addr);
+    spin_lock(&wq->lock);
+    if(*addr != val)
+    {
+        spin_unlock(&wq->lock);
+        return -1;
+    }
+    task->futex_key = (reg_t)addr;
+    _wait_add(wq, task);
+    spin_unlock(&wq->lock);
+    return 0;
+}
+
+/* 唤醒最多n个在addr上等待的任务,返回唤醒的个数 */
+int futex_wake(volatile uint32_t *addr, int n)
+{
+    struct wait_queue *wq = _futex_queue(addr);
+    struct taskInfo *head = NULL;
+    struct taskInfo **tail = &head;
+    int cnt = 0;
+    spin_lock(&wq->lock);
+    struct taskInfo *it = wq->head;
+    while(it != NULL && cnt < n)
+    {
+        struct taskInfo *next = it->wait_next;
+        if(it->futex_key == (reg_t)addr)
+        {
+            _wait_remove(wq, it);
+            *tail = it;
+            tail = &it->wait_next;
+            ++cnt;
+        }
+        it = next;
+    }
+    spin_unlock(&wq->lock);
+    while(head)
+    {
+        struct taskInfo *task = head;
+        head = head->wait_next;
+        task->wait_next = NULL;
+        task_wakeup(task);
+    }
+    return cnt;
+}
+
+#ifdef CONFIG_BENCH
+#define LOCK_BENCH_WORKERS 4
+#define LOCK_BENCH_LOOPS 10000
+#define MUTEX_BENCH_LOOPS 1000
+#define RW_BENCH_WRITES 200
+#define RW_BENCH_READ_MAX (LOCK_BENCH_LOOPS * 10)
+
+static int _bench_mode;
+static volatile int _bench_tas;
+static lock_t _bench_ticket;
+static struct mcs_lock _bench_mcs;
+static volatile uint32_t _bench_counter;
+static volatile int _bench_done;
+static struct wait_queue _bench_wq;
+static struct mutex _bench_mutex;
+/* 互斥锁测试中最近一次mutex_unlock的mtime和交接的统计,都在持有_bench_mutex时读写 */
+static uint64_t _bench_release;
+static uint32_t _bench_handoffs;
+static uint32_t _bench_handoff_total;
+static uint32_t _bench_handoff_max;
+
+/* 读写锁测试的数据,写者每次把两个字都加1,读者读到的两个字不相等就说明读到了写了一半的数据 */
+static rwlock_t _bench_rwlock;
+static struct rwsem _bench_rwsem;
+static struct seqlock _bench_seqlock;
+static volatile uint32_t _bench_pair[2];
+static volatile int _bench_rw_id;
+static volatile int _bench_writer_done;
+static volatile int _bench_gave_up;
+static volatile uint32_t _bench_reads;
+static volatile uint32_t _bench_torn;
+static volatile int _bench_readers_now;
+static volatile int _bench_readers_max;
+static uint32_t _bench_write_wait_max;
+
+/* 测试任务结束,通知lock_bench */
+static void _bench_exit()
+{
+    __sync_fetch_and_add(&_bench_done, 1);
+    wake_up(&_bench_wq, 0);
+    task_exit();
+}
+
+/* 反复获取锁并把计数器加1,mode 0为原来的amoswap测试并置位锁,1为票据锁,2为MCS锁 */
+static void _lock_bench_worker(void *param)
+{
+    int mode = *(int *)param;
+    for(int i = 0; i < LOCK_BENCH_LOOPS; ++i)
+    {
+        if(mode == 0)
+        {
+            push_off();
+            while(__sync_lock_test_and_set(&_bench_tas, 1) != 0)
+                ;
+            ++_bench_counter;
+            __sync_lock_release(&_bench_tas);
+            pop_off();
+        }
+        else if(mode == 1)
+        {
+            lock_acquire(&_bench_ticket);
+            ++_bench_counter;
+            lock_free(&_bench_ticket);
+        }
+        else
+        {
+            struct mcs_node node;
+            mcs_lock(&_bench_mcs, &node);
+            ++_bench_counter;
+            mcs_unlock(&_bench_mcs, &node);
+        }
+    }
+    _bench_exit();
+}
+
+/*
+ * 互斥锁的测试,持锁时task_yield,其他任务来获取时只能阻塞在锁上,没有互斥的话计数器会少
+ * 开始获取之后才有人释放,说明这次是释放时直接交接过来的,统计从mutex_unlock到获取者继续运行的时间
+ */
+static void _mutex_bench_worker(void *param)
+{
+    for(int i = 0; i < MUTEX_BENCH_LOOPS; ++i)
+    {
+        uint64_t before = timer_mtime();
+        mutex_lock(&_bench_mutex);
+        uint64_t now = timer_mtime();
+        if(_bench_release > before)
+        {
+            uint32_t handoff = (uint32_t)(now - _bench_release);
+            ++_bench_handoffs;
+            _bench_handoff_total += handoff;
+            if(handoff > _bench_handoff_max)
+                _bench_handoff_max = handoff;
+        }
+        uint32_t v = _bench_counter;
+        task_yield();
+        _bench_counter = v + 1;
+        _bench_release = timer_mtime();
+        mutex_unlock(&_bench_mutex);
+    }
+    _bench_exit();
+}
+
+/* 读者的临界区,统计同时在读的读者个数,两个字之间停一会,让写了一半的数据更容易被读到 */
+static void _rw_bench_read()
+{
+    int now = __sync_add_and_fetch(&_bench_readers_now, 1);
+    int max = _bench_readers_max;
+    while(now > max && !__sync_bool_compare_and_swap(&_bench_readers_max, max, now))
+        max = _bench_readers_max;
+    uint32_t a = _bench_pair[0];
+    for(volatile int k = 0; k < 10; ++k)
+        ;
+    if(a != _bench_pair[1])
+        __sync_fetch_and_add(&_bench_torn, 1);
+    __sync_fetch_and_sub(&_bench_readers_now, 1);
+}
+
+/*
+ * 读写锁的测试,mode 0为rwlock,1为rwsem,2为seqlock
+ * 第一个开始运行的任务是写者,写RW_BENCH_WRITES次,其他任务是读者,一直读到写者写完
+ * 读者读了RW_BENCH_READ_MAX次写者还没写完,说明写者被读者饿死了
+ */
+static void _rw_bench_worker(void *param)
+{
+    int mode = *(int *)param;
+    if(__sync_fetch_and_add(&_bench_rw_id, 1) == 0)
+    {
+        for(int i = 0; i < RW_BENCH_WRITES; ++i)
+        {
+            uint64_t start = timer_mtime();
+            if(mode == 0)
+                write_lock(&_bench_rwlock);
+            else if(mode == 1)
+                down_write(&_bench_rwsem);
+            else
+                write_seqlock(&_bench_seqlock);
+            uint32_t wait = (uint32_t)(timer_mtime() - start);
+            if(wait > _bench_write_wait_max)
+                _bench_write_wait_max = wait;
+            _bench_pair[0]++;
+            for(volatile int k = 0; k < 10; ++k)
+                ;
+            _bench_pair[1]++;
+            if(mode == 0)
+                write_unlock(&_bench_rwlock);
+            else if(mode == 1)
+                up_write(&_bench_rwsem);
+            else
+                write_sequnlock(&_bench_seqlock);
+        }
+        _bench_writer_done = 1;
+        _bench_exit();
+    }
+    for(int i = 0; !_bench_writer_done; ++i)
+    {
+        if(i == RW_BENCH_READ_MAX)
+        {
+            _bench_gave_up = 1;
+            break;
+        }
+        if(mode == 0)
+        {
+            read_lock(&_bench_rwlock);
+            _rw_bench_read();
+            read_unlock(&_bench_rwlock);
+        }
+        else if(mode == 1)
+        {
+            down_read(&_bench_rwsem);
+            _rw_bench_read();
+            up_read(&_bench_rwsem);
+        }
+        else
+        {
+            uint32_t seq, a, b;
+            do
+            {
+                seq = read_seqbegin(&_bench_seqlock);
+                a = _bench_pair[0];
+                b = _bench_pair[1];
+            } while(read_seqretry(&_bench_seqlock, seq));
+            if(a != b)
+                __sync_fetch_and_add(&_bench_torn, 1);
+        }
+        __sync_fetch_and_add(&_bench_reads, 1);
+    }
+    _bench_exit();
+}
+
+/* 创建n个worker任务并等待它们全部结束,返回花费的CLINT时钟数 */
+static uint64_t _bench_run(task_func worker, int n)
+{
+    _bench_counter = 0;
+    _bench_done = 0;
+    uint64_t start = timer_mtime();
+    for(int i = 0; i < n; ++i)
+        task_create(worker, &_bench_mode, 2, 10, 0);
+    while(1)
+    {
+        wait_prepare(&_bench_wq);
+        if(_bench_done == n)
+            break;
+        task_yield();
+        wait_finish(&_bench_wq);
+    }
+    wait_finish(&_bench_wq);
+    return timer_mtime() - start;
+}
+
+/*
+ * 锁竞争的测试,每种锁创建LOCK_BENCH_WORKERS个任务同时加计数器,空闲的hart会把任务偷走,多个hart时就会竞争同一个锁
+ * 统计全部完成花费的CLINT时钟数,并检查计数器的值,锁有问题的话计数器会少
+ * 然后测试睡眠互斥锁,统计释放时把锁交给等待者的延迟
+ * 最后测试读写锁和顺序锁,检查读者能否并行、有没有读到写了一半的数据、写者会不会被饿死
+ */
+void lock_bench(void *param)
+{
+    static char *modes[] = {"test-and-set", "ticket", "mcs"};
+    printf("\n\n==============> lock_bench <==============\n\n");
+    lock_init(&_bench_ticket);
+    mcs_init(&_bench_mcs);
+    wait_queue_init(&_bench_wq, "lock_bench");
+    mutex_init(&_bench_mutex, "bench_mutex");
+    for(_bench_mode = 0; _bench_mode < 3; ++_bench_mode)
+    {
+        uint64_t cycles = _bench_run(_lock_bench_worker, LOCK_BENCH_WORKERS);
+        printf("%s: %d cycles, counter = %d (expected %d)\n", modes[_bench_mode], (int)cycles,
+            (int)_bench_counter, LOCK_BENCH_WORKERS * LOCK_BENCH_LOOPS);
+    }
+    _bench_release = 0;
+    _bench_handoffs = 0;
+    _bench_handoff_total = 0;
+    _bench_handoff_max = 0;
+    uint64_t cycles = _bench_run(_mutex_bench_worker, LOCK_BENCH_WORKERS);
+    printf("mutex: %d cycles, counter = %d (expected %d)\n", (int)cycles,
+        (int)_bench_counter, LOCK_BENCH_WORKERS * MUTEX_BENCH_LOOPS);
+    if(_bench_handoffs > 0)
+        printf("mutex: %d handoffs, avg %d cycles, max %d cycles\n", _bench_handoffs,
+            _bench_handoff_total / _bench_handoffs, _bench_handoff_max);
+    static char *rw_modes[] = {"rwlock", "rwsem", "seqlock"};
+    rwlock_init(&_bench_rwlock, "bench_rwlock");
+    rwsem_init(&_bench_rwsem, "bench_rwsem");
+    seqlock_init(&_bench_seqlock, "bench_seqlock");
+    for(_bench_mode = 0; _bench_mode < 3; ++_bench_mode)
+    {
+        _bench_pair[0] = 0;
+        _bench_pair[1] = 0;
+        _bench_rw_id = 0;
+        _bench_writer_done = 0;
+        _bench_gave_up = 0;
+        _bench_reads = 0;
+        _bench_torn = 0;
+        _bench_readers_max = 0;
+        _bench_write_wait_max = 0;
+        cycles = _bench_run(_rw_bench_worker, LOCK_BENCH_WORKERS);
+        printf("%s: %d cycles, %d reads, %d writes, torn reads = %d, max concurrent readers = %d\n",
+            rw_modes[_bench_mode], (int)cycles, _bench_reads, _bench_pair[0], _bench_torn, _bench_readers_max);
+        printf("%s: writer max wait %d cycles, writer starved = %d\n",
+            rw_modes[_bench_mode], _bench_write_wait_max, _bench_gave_up);
+    }
+    printf("\n\n==============> END lock_bench <==============\n\n");
+    task_exit();
+}
+#endif
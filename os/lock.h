@@ -3,12 +3,153 @@
 
 #include "type.h"
 
-/* 锁的结构体 */
-typedef struct lock 
+/*
+ * 锁的竞争统计,开启CONFIG_LOCKSTAT时每个锁都带一份,获取和释放时在持有锁的状态下更新,不需要额外的同步
+ * 时间都是CLINT时钟数,等待时间从开始获取到获取成功,包括自旋和阻塞;持有时间从获取成功到释放
+ * 读写锁和顺序锁的读者可以同时持有,读者的统计单独记录在read_*中,由read_busy保护,不统计持有时间
+ * 顺序锁的读者重读一次也算一次竞争
+ * 初始化时挂到全局链表上供lockstat_print打印,所以带统计的锁不能释放,内核中的锁都是静态的
+ */
+struct lock_stat
 {
-    volatile int locked;
+    char *name;
+    uint32_t acquisitions; // 获取的次数
+    uint32_t contended; // 获取时锁已经被持有,需要等待的次数
+    uint64_t wait_total;
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+    uint64_t hold_start; // 本次获取成功的mtime
+    uint32_t read_acquisitions;
+    uint32_t read_contended;
+    uint64_t read_wait_total;
+    uint64_t read_wait_max;
+    volatile int read_busy;
+    int registered;
+    struct lock_stat *next;
+};
+
+/*
+ * 票据锁,获取时用amoadd取一个号,等到owner叫到这个号才进入,释放时叫下一个号
+ * 按取号的先后顺序获取,多个hart竞争时不会有hart一直抢不到;等待时只读owner,不会反复写锁所在的cache行
+ * 获取时和spinlock一样关中断,可以嵌套
+ */
+typedef struct lock
+{
+    volatile uint32_t next; // 下一个要发出的号
+    volatile uint32_t owner; // 当前可以进入的号
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
 } lock_t;
 
-extern int atomic_swap(lock_t *lock);
+/*
+ * 内核自旋锁,用于多个hart之间保护内核的共享数据,也是票据锁
+ * 获取锁时会关闭当前hart的中断,防止持有锁时被中断,而中断处理函数又去获取同一个锁造成死锁
+ */
+struct spinlock
+{
+    volatile uint32_t next;
+    volatile uint32_t owner;
+    char *name; // 锁的名字,用于调试
+    int cpu; // 持有锁的hart id
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
+};
+
+/*
+ * MCS队列锁,每个等待者在自己的mcs_node上自旋,释放时只写下一个等待者的节点
+ * 等待的hart很多时比票据锁少了所有hart读同一个owner产生的cache行失效,适合竞争激烈的锁
+ * mcs_node由调用方提供,一般放在栈上,从获取到释放都要保持有效
+ */
+struct mcs_node
+{
+    struct mcs_node *volatile next;
+    volatile int locked;
+};
+
+struct mcs_lock
+{
+    struct mcs_node *volatile tail; // 队尾的等待者,为NULL表示锁空闲
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
+};
+
+struct taskInfo;
+
+/*
+ * 等待队列,等待某个条件的任务按先后顺序排在这里,条件满足时由wake_up唤醒
+ * 用法是先wait_prepare,再检查条件,不满足才task_yield,醒来后wait_finish并重新检查条件
+ */
+struct wait_queue
+{
+    struct spinlock lock;
+    struct taskInfo *head;
+    struct taskInfo **tail;
+};
+
+/*
+ * 睡眠互斥锁,只能在任务中使用
+ * 获取不到时先在持有者正在其他hart上运行时自旋一会,持有者没有在运行就进入等待队列阻塞
+ * 释放时如果有等待者,直接把锁交给队头的任务并唤醒它,不需要它醒来后再去抢
+ */
+struct mutex
+{
+    volatile int locked;
+    struct taskInfo *volatile owner; // 持有锁的任务
+    struct wait_queue wq;
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
+};
+
+/* 持有者在其他hart上运行时最多自旋的次数,超过之后就阻塞 */
+#define MUTEX_SPIN_COUNT 1000
+
+/*
+ * 读写自旋锁,多个读者可以在不同的hart上同时持有,写者独占,获取时关中断
+ * 低位是读者的个数,有写者在等待时置RW_WAIT,新的读者不再进入,防止写者一直拿不到锁
+ * 目前内核中还没有读多写少到需要它的路径,和rwsem一样只作为库提供,由CONFIG_BENCH的lock_bench测试
+ */
+typedef struct rwlock
+{
+    volatile uint32_t val;
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
+} rwlock_t;
+
+#define RW_WRITER 0x80000000
+#define RW_WAIT 0x40000000
+
+/*
+ * 读写信号量,和读写锁一样但获取不到时阻塞,只能在任务中使用,持有期间可以睡眠
+ * count为读者的个数,为-1表示被写者持有,由wq.lock保护;有写者在等待时新的读者也要等待
+ */
+struct rwsem
+{
+    int count;
+    int writers_waiting;
+    struct wait_queue wq;
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat;
+#endif
+};
+
+/*
+ * 顺序锁,用于读得多、写得少并且很小的数据,例如每个hart的空闲时间(sched.c的_idle_seq)
+ * 写者持有lock并在修改前后各把seq加1,读者不加锁,读之前和读之后seq相同且为偶数才说明读到的数据完整,否则重读
+ * 读者不会写共享的cache行,多个hart可以同时读,也不会阻塞写者
+ */
+struct seqlock
+{
+    volatile uint32_t seq;
+    struct spinlock lock; // 写者的统计记录在这个锁中
+#ifdef CONFIG_LOCKSTAT
+    struct lock_stat stat; // 只记录读者
+#endif
+};
 
 #endif
\ No newline at end of file
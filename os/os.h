@@ -4,6 +4,8 @@
 #include "riscv.h"
 #include "type.h"
 #include "platform.h"
+#include "bitops.h"
+#include "page.h"
 #include "sched.h"
 #include "lock.h"
 #include "timer.h"
@@ -19,31 +21,60 @@ extern void uart_gets(void);
 extern void uart_ier(void);
 
 /* printf.c */
+extern void printf_init(void);
 extern int printf(const char *s, ...);
 extern void panic(char *s);
 
+/* string.c */
+extern void *memset(void *dest, int c, size_t n);
+extern void *memcpy(void *dest, const void *src, size_t n);
+extern void *memmove(void *dest, const void *src, size_t n);
+
 /* page.c */
 extern void page_init(void);
 extern void *page_alloc(int npages);
 extern void page_free(void *p);
 extern void *malloc(size_t size);
 extern void free(void *p);
+struct kmem_cache;
+extern struct kmem_cache *kmem_cache_create(const char *name, size_t size, void (*ctor)(void *obj));
+extern void *kmem_cache_alloc(struct kmem_cache *cache);
+extern void kmem_cache_free(struct kmem_cache *cache, void *p);
+extern size_t malloc_usable_size(void *p);
+extern int heap_get_stats(struct heap_stats *stats);
+extern void heap_print_stats(void);
 // extern void page_test(void);
 // extern void malloc_test(void);
+extern void malloc_bench(void);
 
 /* sched.c */
 extern void sched_init(void);
+extern void sched_init_hart(void);
 extern void schedule(void);
+extern void schedule_yield(void);
 #ifdef RV32
+extern void task_sleep(uint32_t tick);
 extern void task_delay(uint32_t tick);
 #else
+extern void task_sleep(uint64_t tick);
 extern void task_delay(uint64_t tick);
 #endif
+extern void task_sleep_ns(uint64_t ns);
+extern void task_delay_ns(uint64_t ns);
 extern void task_yield(void);
+extern void task_resched(void);
+extern void task_set_blocked(void);
+extern void task_set_running(void);
+extern void task_wakeup(struct taskInfo *task);
+extern struct taskInfo *task_self(void);
+extern void sched_print_stats(void);
+extern uint64_t task_runtime_ns(void);
+extern void cpu_idle(void);
+extern void sched_bench(void *param);
 #ifdef RV32
-extern int task_create(task_func task, void *param, int priority, uint32_t timeslice);
+extern int task_create(task_func task, void *param, int priority, uint32_t timeslice, size_t stack_size);
 #else
-extern int task_create(task_func task, void *param, int priority, uint64_t timeslice);
+extern int task_create(task_func task, void *param, int priority, uint64_t timeslice, size_t stack_size);
 #endif
 extern void task_exit(void);
 extern void back_os(void);
@@ -63,21 +94,86 @@ extern void plic_init(void);
 extern int plic_claim(void);
 extern void plic_complete(int irq);
 
+/* trap.c */
+#ifdef CONFIG_IRQSTAT
+extern void irqoff_begin(void);
+extern void irqoff_end(void);
+#else
+#define irqoff_begin()
+#define irqoff_end()
+#endif
+
 /* timer.c */
 extern void timer_load(int interval);
+extern uint64_t timer_mtime(void);
+extern void timer_idle_enter(void);
+extern void timer_idle_exit(void);
+extern uint64_t timer_ns_to_mtime(uint64_t ns);
+extern uint64_t timer_mtime_to_ns(uint64_t mtime);
+extern uint64_t timer_mtime_to_us(uint64_t mtime);
+extern void timer_slice_start(struct taskInfo *task);
 extern void timer_init(void);
+extern void timer_init_hart(void);
 extern void timer_handler(void); 
-extern void timer_init(void);
 #ifdef RV32
 extern struct timer *timer_create(timer_func func, void *args, uint32_t timeout);
+extern struct timer *timer_create_periodic(timer_func func, void *args, uint32_t timeout, uint32_t period);
 #else
 extern struct timer *timer_create(timer_func func, void *args, uint64_t timeout);
+extern struct timer *timer_create_periodic(timer_func func, void *args, uint64_t timeout, uint64_t period);
 #endif
+extern struct timer *timer_create_ns(timer_func func, void *args, uint64_t ns);
 extern void timer_delete(struct timer *t);
+#ifdef RV32
+extern void timer_sleep(struct taskInfo *task, uint32_t tick);
+#else
+extern void timer_sleep(struct taskInfo *task, uint64_t tick);
+#endif
+extern void timer_sleep_ns(struct taskInfo *task, uint64_t ns);
 
 /* lock.h */
+extern void lock_init(lock_t *lock);
 extern void lock_acquire(lock_t *lock);
 extern void lock_free(lock_t *lock);
+extern void push_off(void);
+extern void pop_off(void);
+extern void spin_init(struct spinlock *lk, char *name);
+extern int spin_holding(struct spinlock *lk);
+extern void spin_lock(struct spinlock *lk);
+extern void spin_unlock(struct spinlock *lk);
+extern void mcs_init(struct mcs_lock *lk);
+extern void mcs_lock(struct mcs_lock *lk, struct mcs_node *node);
+extern void mcs_unlock(struct mcs_lock *lk, struct mcs_node *node);
+extern void rwlock_init(rwlock_t *lock, char *name);
+extern void read_lock(rwlock_t *lock);
+extern void read_unlock(rwlock_t *lock);
+extern void write_lock(rwlock_t *lock);
+extern void write_unlock(rwlock_t *lock);
+extern void rwsem_init(struct rwsem *sem, char *name);
+extern void down_read(struct rwsem *sem);
+extern void up_read(struct rwsem *sem);
+extern void down_write(struct rwsem *sem);
+extern void up_write(struct rwsem *sem);
+extern void seqlock_init(struct seqlock *sl, char *name);
+extern void write_seqlock(struct seqlock *sl);
+extern void write_sequnlock(struct seqlock *sl);
+extern uint32_t read_seqbegin(struct seqlock *sl);
+extern int read_seqretry(struct seqlock *sl, uint32_t start);
+#ifdef CONFIG_LOCKSTAT
+extern void lockstat_print(void);
+#endif
+extern void futex_init(void);
+extern int futex_wait(volatile uint32_t *addr, uint32_t val);
+extern int futex_wake(volatile uint32_t *addr, int n);
+extern void lock_bench(void *param);
+extern void wait_queue_init(struct wait_queue *wq, char *name);
+extern void wait_prepare(struct wait_queue *wq);
+extern void wait_finish(struct wait_queue *wq);
+extern int wake_up(struct wait_queue *wq, int n);
+extern void mutex_init(struct mutex *m, char *name);
+extern void mutex_lock(struct mutex *m);
+extern int mutex_trylock(struct mutex *m);
+extern void mutex_unlock(struct mutex *m);
 
 /* syscall.c */
 extern void do_syscall(struct context *ctx);
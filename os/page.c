@@ -30,10 +30,12 @@ extern uint64_t HEAP_SIZE;
 /*
  * 由于在heap的起始位置处需要存放每个页表的管理信息
  * 所以实际动态分配内存的起始地址为：HEAP_START + 所有管理信息的大小
- * 管理信息包括是否被使用,是否是一大段内存的终止位置等信息,每个4K页的管理信息用1字节就足够了
- * 128MB / 4KB = 32K,共32K个4K页,每个页管理信息占1字节,所以总共需要32KB存储管理信息
- * 又由于每个页为4KB,所以需要32KB / 4KB = 8,也就是8个4K页来存储管理信息
- * 所以实际动态分配内存的起始地址为：HEAP_START + 所有管理信息的大小 = HEAP_START + 8 * 4K
+ * 管理信息包括是否被使用,是否是一大段内存的终止位置,buddy空闲块的阶,一大段内存的页数等信息,每个4K页的管理信息用4字节
+ * 128MB / 4KB = 32K,共32K个4K页,每个页管理信息占4字节,所以总共需要128KB存储管理信息
+ * 又由于每个页为4KB,所以需要128KB / 4KB = 32,也就是32个4K页来存储管理信息
+ * 页管理信息后面是两个位图,每页1位,一个标记buddy空闲块的第一页,一个标记已分配的一大段内存的第一页
+ * 页管理信息只有在对应的位图置位时才有意义,所以初始化时只需要清空位图,不需要逐个清空页管理信息
+ * 管理信息所占的页数在page_init中根据heap的实际大小计算,实际动态分配内存的起始地址为：HEAP_START + 所有管理信息的大小
  */
 #ifdef RV32
 static uint32_t _alloc_start = 0;
@@ -45,33 +47,26 @@ static uint64_t _alloc_end = 0;
 static uint64_t _num_pages = 0;
 #endif
 
-#define PAGE_SIZE 4096
-
-/* 用于4K对齐,4K是2的12次方,对齐方式见函数_align_page */
-#define PAGE_ORDER 12
-
-/* 页内block的大小 */
-#define MALLOC_SIZE 4
-
-/* 页内能分配成block的最大字节 */
-#define ALLOCABLE_SIZE 3276
+/*
+ * buddy系统的阶数,阶为k的空闲块由2^k个连续的页组成,且起始页号按2^k对齐
+ * 128MB的heap最多32K个页,所以阶0-14就足够了
+ */
+#define MAX_ORDER 15
 
-/* 页内管理block的管理信息的字节 */
-#define MALLOC_TABLE_SIZE 820
+/*
+ * malloc的大小类,小于等于SLAB_MAX_SIZE的请求按照大小类从对应的对象缓存中分配
+ * 大小类的个数SLAB_CLASS_NUM定义在page.h中
+ */
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 1024
 
 /* 页管理信息 */
 #define PAGE_TAKEN (uint8_t)(1 << 0)
 #define PAGE_LAST (uint8_t)(1 << 1)
 #define PAGE_FIRST (uint8_t)(1 << 2)
 #define PAGE_MALLOC (uint8_t)(1 << 3) // 当前页是被malloc管理的
-/* 与malloc和free有关的页/block管理信息 */
-#define BLOCK_TAKEN (uint8_t)(1 << 0)
-#define BLOCK_LAST (uint8_t)(1 << 1)
-#define BLOCK_FIRST (uint8_t)(1 << 2)
 #define PAGE_SOFT_FIRST (uint8_t)(1 << 4) // 表示前一页是被page_alloc分配的,不是malloc分配的
 
-/* 1 << 5暂未使用, 1 << 6和1 << 7表示当前页中有多少block被使用 */
-
 /*
  * 页描述结构体
  * flags: 8 bits
@@ -79,30 +74,89 @@ static uint64_t _num_pages = 0;
  *   bit 1: 是否是一大段内存的最后一页
  *   bit 2: 是否是一大段内存的第一页
  *   bit 3: 当前页是否是被malloc控制的
+ * order: 当前页是buddy空闲块的第一页时,表示该空闲块的阶
+ * npages: 当前页是一大段内存的第一页时,表示这段内存的页数
+ * 一大段内存只有第一页和最后一页有管理信息,中间的页的管理信息没有意义,这样分配和释放都不需要逐页设置
  */
 struct Page
 {
     uint8_t flags;
+    uint8_t order;
+    uint16_t npages;
 };
 
 /*
- * block描述结构体
- * flags: 8 bits
- *   bit 0: 是否被使用了
- *   bit 1: 是否是内存的最后一个block
- *   bit 2: 是否是内存的第一个一个block
- *   bit 3: 暂未使用
- *   bit 4: 前一页是被page_alloc分配的,不是malloc分配的
- *   bit 5: 暂未使用
- *   bit 6: 表示当前页中有多少block被使用, 是10 bit位的倒数第二高位
- *   bit 7: 表示当前页中有多少block被使用, 是10 bit位的最高位
- *   这里的bit 6和bit 7只有第819 block才有意义
-*/
-struct Block
+ * buddy空闲块链表节点
+ * 空闲块中的内存没有被使用,所以直接将链表节点放在空闲块第一页的开头,不需要额外的管理信息
+ */
+struct FreeArea
 {
-    uint8_t flags;
+    struct FreeArea *next;
+    struct FreeArea *prev;
 };
 
+/* 每一阶的空闲块链表 */
+static struct FreeArea *_free_area[MAX_ORDER];
+
+/*
+ * _buddy_map: 第i位为1表示第i页是buddy空闲块的第一页
+ * _first_map: 第i位为1表示第i页是已分配的一大段内存的第一页
+ * 如果用每页1位的空闲位图,buddy每次拆分合并都要改2^order位,所以这里只标记块的第一页,拆分合并都只改1位
+ */
+static reg_t *_buddy_map = NULL;
+static reg_t *_first_map = NULL;
+
+/*
+ * 对象缓存,每个缓存管理一种固定大小的对象
+ * 缓存由若干slab组成,每个slab占一页,页的开头是slab的管理信息,后面是等大小的对象
+ * malloc的每个大小类也是一个对象缓存
+ */
+struct kmem_cache
+{
+    const char *name; // 缓存名称
+    reg_t size; // 对象大小,已经按照对齐要求向上取整
+    reg_t offset; // slab中第一个对象相对页开头的偏移
+    reg_t free_offset; // 空闲链表指针在对象中的偏移
+    uint16_t objs; // 每个slab中的对象个数
+    void (*ctor)(void *obj); // 对象构造函数,在slab创建时对每个对象调用一次,可以为NULL
+    struct Slab *partial; // 还有空闲对象的slab链表
+    uint32_t slabs; // slab个数
+    uint32_t inuse; // 已分配出去的对象个数
+};
+
+/*
+ * slab管理信息,放在slab页的开头
+ * 空闲对象的前几个字节存放下一个空闲对象的地址,组成嵌入式的空闲链表,所以分配和释放都是O(1)的
+ */
+struct Slab
+{
+    struct Slab *next; // 同一缓存的partial链表中的下一个slab
+    struct Slab *prev; // 同一缓存的partial链表中的前一个slab
+    void *freelist; // 空闲对象链表
+    struct kmem_cache *cache; // slab所属的缓存
+    uint16_t inuse; // 已分配出去的对象个数
+};
+
+/* malloc每个大小类的对象大小 */
+static const uint16_t _kmalloc_size[SLAB_CLASS_NUM] = {16, 32, 64, 128, 256, 512, 1024};
+static const char *_kmalloc_name[SLAB_CLASS_NUM] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+
+/* malloc每个大小类的缓存 */
+static struct kmem_cache _kmalloc_caches[SLAB_CLASS_NUM];
+
+static void _kmem_cache_init(struct kmem_cache *cache, const char *name, reg_t size, reg_t align, void (*ctor)(void *obj));
+
+/* heap的统计信息 */
+/* 保护buddy、slab和统计信息,所有hart共享同一个heap,对外的函数获取锁后调用内部的_xxx函数 */
+static struct spinlock _heap_lock;
+
+static reg_t _used_pages = 0; // 已分配页数
+static reg_t _max_used_pages = 0; // 已分配页数的最高值
+static uint32_t _alloc_count = 0; // malloc成功的次数
+static uint32_t _free_count = 0; // free的次数
+static uint32_t _fail_count = 0; // malloc失败的次数
 
 /* 清除页信息,也就是回收页 */
 static inline void _clear_page(struct Page *page) {
@@ -148,12 +202,6 @@ static inline int _is_malloced(struct Page *page)
     return (page->flags & PAGE_MALLOC) ? 1 : 0;
 }
 
-/* 判断是否是第一页 */
-static inline int _is_page_first(struct Page *page)
-{
-    return (page->flags & PAGE_FIRST) ? 1 : 0;
-}
-
 /* 通过page获取页内存初始位置 */
 static inline void *_get_start_mem_by_page(struct Page *page)
 {
@@ -183,26 +231,137 @@ static inline struct Page *_get_page_by_addr(void *p)
     return ((struct Page*)HEAP_START + page_count);
 }
 
+/* 通过页号获取页管理信息 */
+static inline struct Page *_get_page_by_index(reg_t idx)
+{
+    return (struct Page*)HEAP_START + idx;
+}
+
+/* 通过页号获取页内存初始位置 */
+static inline void *_get_mem_by_index(reg_t idx)
+{
+    return (void*)(_alloc_start + idx * PAGE_SIZE);
+}
+
+/* 通过页内存初始位置获取页号 */
+static inline reg_t _get_index_by_mem(void *p)
+{
+    return ((reg_t)p - _alloc_start) / PAGE_SIZE;
+}
+
+/* 将页号为idx,阶为order的空闲块放入对应阶的空闲链表头部 */
+static void _free_area_add(reg_t idx, int order)
+{
+    struct Page *page = _get_page_by_index(idx);
+    struct FreeArea *area = (struct FreeArea*)_get_mem_by_index(idx);
+    set_bit(_buddy_map, idx);
+    page->order = order;
+    area->prev = NULL;
+    area->next = _free_area[order];
+    if(_free_area[order])
+        _free_area[order]->prev = area;
+    _free_area[order] = area;
+}
+
+/* 将页号为idx,阶为order的空闲块从对应阶的空闲链表中取出,由于是双向链表,所以是O(1)的 */
+static void _free_area_del(reg_t idx, int order)
+{
+    struct FreeArea *area = (struct FreeArea*)_get_mem_by_index(idx);
+    if(area->prev)
+        area->prev->next = area->next;
+    else
+        _free_area[order] = area->next;
+    if(area->next)
+        area->next->prev = area->prev;
+    clear_bit(_buddy_map, idx);
+}
+
+/* 判断页号为idx的页是否是一个阶为order的空闲块的第一页 */
+static inline int _is_buddy_free(reg_t idx, int order)
+{
+    // 空闲块超出了heap的范围,那么这个buddy不存在
+    if(idx + ((reg_t)1 << order) > _num_pages)
+        return 0;
+    return test_bit(_buddy_map, idx) && _get_page_by_index(idx)->order == order;
+}
+
+/* 判断页号为idx的页是否是已分配的一大段内存的第一页 */
+static inline int _is_alloc_first(reg_t idx)
+{
+    return test_bit(_first_map, idx);
+}
+
+/*
+ * 释放页号为idx,阶为order的块
+ * 块的buddy的页号为idx ^ 2^order,如果buddy也是同阶的空闲块,那么就合并成更高一阶的块,然后继续向上合并
+ * 最多合并MAX_ORDER次,所以是O(log n)的
+ */
+static void _buddy_free_block(reg_t idx, int order)
+{
+    while(order < MAX_ORDER - 1)
+    {
+        reg_t buddy = idx ^ ((reg_t)1 << order);
+        if(!_is_buddy_free(buddy, order))
+            break;
+        _free_area_del(buddy, order);
+        // 合并后的块从两者中页号较小的开始
+        idx &= buddy;
+        ++order;
+    }
+    _free_area_add(idx, order);
+}
+
+/*
+ * 释放从页号idx开始的连续n个页
+ * n不一定是2的幂,所以从前往后每次拆出一个尽量大的块,块既要按照自身大小对齐,又不能超出范围
+ * 这样最多拆出2 * MAX_ORDER个块
+ */
+static void _buddy_free_range(reg_t idx, reg_t n)
+{
+    while(n > 0)
+    {
+        int order = 0;
+        while(order < MAX_ORDER - 1 && !(idx & ((reg_t)1 << order)) && ((reg_t)2 << order) <= n)
+            ++order;
+        _buddy_free_block(idx, order);
+        idx += (reg_t)1 << order;
+        n -= (reg_t)1 << order;
+    }
+}
+
 /* page初始化 */
 void page_init() {
-    // 页的总个数
-    _num_pages = (HEAP_SIZE  / PAGE_SIZE) - 8;
+    // heap前面存放页管理信息和两个位图,计算管理信息需要多少个页
+    reg_t total_pages = HEAP_SIZE / PAGE_SIZE;
+    reg_t map_words = (total_pages + BITS_PER_REG - 1) / BITS_PER_REG;
+    reg_t map_start = (HEAP_START + total_pages * sizeof(struct Page) + sizeof(reg_t) - 1) & ~(sizeof(reg_t) - 1);
+    reg_t meta_end = map_start + 2 * map_words * sizeof(reg_t);
+
+    // 设置开始和结束开辟内存的地方,注意位置要4k对齐
+    // 由于HEAP_START不一定是4K对齐的,所以页的总个数要按照对齐后的开始位置来计算,否则最后一页可能会超出内存
+    _alloc_start = _align_page(meta_end);
+    _num_pages = (HEAP_END - _alloc_start) / PAGE_SIZE;
+    _alloc_end = _alloc_start + _num_pages * PAGE_SIZE;
     printf("HEAP_START = %x, HEAP_SIZE = %x, num of pages = %d\n", HEAP_START, HEAP_SIZE, _num_pages);
     
-    // 初始化heap前面的页管理信息
-    // 由于page是Page类型的指针,指向的为uint8_t的数值
-    // 所以++page每次走过一个字节,而不是4K,所以虽然这里使用的是_num_pages,但是指的heap最前面的页管理信息
-    // 因为后面的_num_pages个4K页的_num_pages个管理信息在前部
-    struct Page *page = (struct Page*)HEAP_START;
-    for(int i = 0; i < _num_pages; ++i)
+    // 初始化位图,两个位图是连续的,一起清零
+    _buddy_map = (reg_t *)map_start;
+    _first_map = _buddy_map + map_words;
+    memset(_buddy_map, 0, 2 * map_words * sizeof(reg_t));
+
+    // 所有页都放入buddy的空闲链表
+    for(int i = 0; i < MAX_ORDER; ++i)
     {
-        _clear_page(page);
-        ++page;
+        _free_area[i] = NULL;
     }
-
-    // 设置开始和结束开辟内存的地方,注意位置要4k对齐
-    _alloc_start = _align_page(HEAP_START + 8 * PAGE_SIZE);
-    _alloc_end = _alloc_start + _num_pages * PAGE_SIZE;
+    _buddy_free_range(0, _num_pages);
+    for(int i = 0; i < SLAB_CLASS_NUM; ++i)
+    {
+        _kmem_cache_init(&_kmalloc_caches[i], _kmalloc_name[i], _kmalloc_size[i], SLAB_MIN_SIZE, NULL);
+    }
+    _used_pages = _max_used_pages = 0;
+    _alloc_count = _free_count = _fail_count = 0;
+    spin_init(&_heap_lock, "heap");
 
     printf("TEXT:   0x%x -> 0x%x\n", TEXT_START, TEXT_END);
 	printf("RODATA: 0x%x -> 0x%x\n", RODATA_START, RODATA_END);
@@ -211,57 +370,56 @@ void page_init() {
 	printf("HEAP:   0x%x -> 0x%x\n", _alloc_start, _alloc_end);
 }
 
-/* 按照页个数分配内存 */
-void *page_alloc(int npages)
+/*
+ * 按照页个数分配内存
+ * 从能容纳npages个页的最小阶开始,找到第一个非空的空闲链表,取出一个空闲块
+ * 空闲块中超出npages的部分再按buddy拆分归还,这样分配的代价只与阶数有关,与heap的使用情况无关
+ */
+static void *_page_alloc(int npages)
 {
     if(npages < 1)
     {
         return NULL;
     }
-    int found = 0;
-    // end_page指的是管理信息中的
-    int end_page = _num_pages - npages;
-    // page指向页管理信息的第0项
+    int order = 0;
+    while(order < MAX_ORDER && ((reg_t)1 << order) < npages)
+        ++order;
+    while(order < MAX_ORDER && _free_area[order] == NULL)
+        ++order;
+    if(order >= MAX_ORDER)
+        return NULL;
+
+    reg_t idx = _get_index_by_mem(_free_area[order]);
+    _free_area_del(idx, order);
+
     // 后面的4K页是存放数据,前面的页管理信息才是控制4K页的属性,所以应该是对页管理信息进行修改
-    // 而不是真正的4K页
-    struct Page *page = (struct Page*)HEAP_START;
-    struct Page *tmp = NULL;
-    for(int i = 0; i <= end_page; ++i)
-    {
-        if(_is_page_free(page))
-        {
-            found = 1;
-            tmp = page;
-            for (int j = 1; j < npages; ++j)
-            {
-                if(!_is_page_free(++tmp))
-                {
-                    found = 0;
-                    break;
-                }
-            }
+    // 而不是真正的4K页,只需要设置第一页和最后一页,页数记录在第一页中
+    // 页管理信息中可能是以前留下的值,所以这里直接赋值而不是加上标志
+    struct Page *page = _get_page_by_index(idx);
+    (page + npages - 1)->flags = PAGE_TAKEN | PAGE_LAST;
+    page->flags = (npages == 1 ? PAGE_LAST : 0) | PAGE_TAKEN | PAGE_FIRST;
+    page->npages = npages;
+    set_bit(_first_map, idx);
+
+    _used_pages += npages;
+    if(_used_pages > _max_used_pages)
+        _max_used_pages = _used_pages;
+
+    // 空闲块中多余的页归还给buddy
+    _buddy_free_range(idx + npages, ((reg_t)1 << order) - npages);
+    return _get_mem_by_index(idx);
+}
 
-            if(found)
-            {
-                tmp = page;
-                _set_page_flags(page, PAGE_FIRST);
-                for(int j = 0; j < npages; ++j)
-                {
-                    _set_page_flags(tmp++, PAGE_TAKEN);
-                }
-                // 最后一个还需要设置为last
-                --tmp;
-                _set_page_flags(tmp, PAGE_LAST);
-                return (void*)(_alloc_start + i * PAGE_SIZE);
-            }
-        }
-        ++page;
-    }
-    return NULL;
+void *page_alloc(int npages)
+{
+    spin_lock(&_heap_lock);
+    void *p = _page_alloc(npages);
+    spin_unlock(&_heap_lock);
+    return p;
 }
 
 /* 按页释放内存 */
-void page_free(void *p)
+static void _page_free(void *p)
 {
 #ifdef RV32
     if(!p || (uint32_t)p >= _alloc_end || (uint32_t)p < _alloc_start) return;
@@ -273,271 +431,242 @@ void page_free(void *p)
     struct Page *page = (struct Page *)HEAP_START + ((uint64_t)p - _alloc_start) / PAGE_SIZE;
 #endif
 
-    // 若是分配了几页连续的内存A,然后从中间的某个位置B开始 page_free,然后下一次从B开始分配新区域
-    // 此时再去page_free掉A剩下的,由于此时剩下的A中的最后一页没有PAGE_LAST标志,那么就会连同B新分配的一起free了
-    // 所以若出现从中间的某个位置B开始 page_free,此时B所在的页不是PAGE_FIRST,那么就需要将前一页设置为PAGE_LAST
-    if(!_is_page_first(page))
+    reg_t idx = page - (struct Page *)HEAP_START;
+    reg_t npages;
+    if(_is_alloc_first(idx))
     {
-        struct Page *prev_page = page - 1;
-        void *prev = _get_start_mem_by_page(prev_page);
-#ifdef RV32
-        if((uint32_t)prev >= _alloc_start && !_is_page_free(prev_page))
-            _set_page_flags(prev_page, PAGE_LAST);
-#else
-        if((uint64_t)prev >= _alloc_start && !_is_page_free(prev_page))
-            _set_page_flags(prev_page, PAGE_LAST);
-#endif
+        // 页数记录在第一页中,只需要清除第一页和最后一页的管理信息
+        npages = page->npages;
+        _clear_page(page + npages - 1);
+        _clear_page(page);
+        clear_bit(_first_map, idx);
     }
-
-    while(!_is_page_free(page))
+    else
     {
-        if(_is_page_last(page))
-        {
-            _clear_page(page);
-            break;
-        }
-        else
-        {
-            _clear_page(page++);
-        }
+        // 若是分配了几页连续的内存A,然后从中间的某个位置B开始 page_free,那么就释放从B到A的最后一页
+        // 中间页没有管理信息,所以需要在位图中往前找到A的第一页,再把A的第一页记录的页数改成B之前的页数,B的前一页设置为PAGE_LAST
+        reg_t first = find_prev_bit(_first_map, idx);
+        // 往前找不到或者找到的内存段不包含B,说明B本身就是空闲的
+        if(first == (reg_t)-1 || idx >= first + _get_page_by_index(first)->npages)
+            return;
+        struct Page *first_page = _get_page_by_index(first);
+        npages = first + first_page->npages - idx;
+        _clear_page(page + npages - 1);
+        first_page->npages = idx - first;
+        _set_page_flags(page - 1, PAGE_TAKEN | PAGE_LAST);
     }
+    _used_pages -= npages;
+    _buddy_free_range(idx, npages);
 }
 
-/* 
- * 通过页初始位置获取页中block的初始位置 
- * 参数为页的初始位置
- */
-struct Block *_get_start_block_by_addr(void *p)
-{
-    return (struct Block*)(p + ALLOCABLE_SIZE - 1);
-}
-
-/*
- * 通过任意位置地址获取其所在的block 
- */
-struct Block *_get_block_by_addr(void *p)
+void page_free(void *p)
 {
-    // 获取p所在页的起始位置
-    void *page_mem = _get_start_mem_by_addr(p);
-    // 获取p所在页block的起始位置
-    struct Block *block_start = _get_start_block_by_addr(page_mem);
-
-    return block_start + (p - page_mem) / MALLOC_SIZE;
+    spin_lock(&_heap_lock);
+    _page_free(p);
+    spin_unlock(&_heap_lock);
 }
 
-/*
- * block是否是free
- */
-int _is_block_free(struct Block *block)
+/* 获取size对应的malloc大小类下标 */
+static inline int _kmalloc_class(size_t size)
 {
-    return (block->flags & BLOCK_TAKEN) ? 0 : 1;
+    int cls = 0;
+    while(_kmalloc_size[cls] < size)
+        ++cls;
+    return cls;
 }
 
-/* 设置block属性 */
-void _set_block_flags(struct Block *block, uint8_t flags)
+/* 将slab放入partial链表头部 */
+static inline void _slab_partial_add(struct Slab *slab)
 {
-    block->flags |= flags;
+    struct kmem_cache *cache = slab->cache;
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if(slab->next)
+        slab->next->prev = slab;
+    cache->partial = slab;
 }
 
-/* 是否是最后一个block */
-static inline int _is_block_last(struct Block *block)
+/* 将slab从partial链表中取出 */
+static inline void _slab_partial_del(struct Slab *slab)
 {
-    return (block->flags & BLOCK_LAST) ? 1 : 0;
+    if(slab->prev)
+        slab->prev->next = slab->next;
+    else
+        slab->cache->partial = slab->next;
+    if(slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
 }
 
-/* 判断是否是第一个block */
-static inline int _is_block_first(struct Block *block)
+/* 从buddy申请一页作为新的slab,构造所有对象并串成空闲链表 */
+static struct Slab *_slab_create(struct kmem_cache *cache)
 {
-    return (block->flags & BLOCK_FIRST) ? 1 : 0;
+    void *mem = _page_alloc(1);
+    if(mem == NULL)
+        return NULL;
+    _set_page_flags(_get_page_by_addr(mem), PAGE_MALLOC);
+    ++cache->slabs;
+
+    struct Slab *slab = (struct Slab *)mem;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+    // 从后往前串起来,这样分配的时候是从低地址往高地址分配
+    for(int i = cache->objs - 1; i >= 0; --i)
+    {
+        void *obj = mem + cache->offset + i * cache->size;
+        if(cache->ctor)
+            cache->ctor(obj);
+        *(void **)(obj + cache->free_offset) = slab->freelist;
+        slab->freelist = obj;
+    }
+    _slab_partial_add(slab);
+    return slab;
 }
 
-/* 
- * 初始化malloc
- * p指的是页的初始地址 
+/*
+ * 初始化对象缓存
+ * 对象大小按照align向上取整,第一个对象的偏移也按照align对齐,由于slab页是4K对齐的,所以每个对象都是align对齐的
+ * 空闲对象中要存放空闲链表指针,所以对象至少要有一个指针大
+ * 有构造函数的对象在空闲时也要保持构造后的状态,所以空闲链表指针放到对象后面,不能覆盖对象本身
  */
-struct Block *_malloc_init(void *p)
+static void _kmem_cache_init(struct kmem_cache *cache, const char *name, reg_t size, reg_t align, void (*ctor)(void *obj))
 {
-    struct Block *block = _get_start_block_by_addr(p);
-    struct Block *tmp = block;
-    for (int i = 0; i < MALLOC_TABLE_SIZE; ++i, ++tmp)
+    cache->free_offset = 0;
+    if(ctor)
     {
-        tmp->flags = 0;
+        cache->free_offset = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        size = cache->free_offset + sizeof(void *);
     }
-    return block;
+    if(size < sizeof(void *))
+        size = sizeof(void *);
+    cache->name = name;
+    cache->size = (size + align - 1) & ~(align - 1);
+    cache->offset = (sizeof(struct Slab) + align - 1) & ~(align - 1);
+    cache->objs = (PAGE_SIZE - cache->offset) / cache->size;
+    cache->ctor = ctor;
+    cache->partial = NULL;
+    cache->slabs = 0;
+    cache->inuse = 0;
 }
 
-/* 
- * 增加一个页中block使用数目 
- * 参数为页中block管理信息的初始位置
+/*
+ * 创建对象缓存
+ * 对象按照cache line对齐,避免不同对象共享同一个cache line
+ * 一个slab只有一页,所以对象不能超过一页减去slab管理信息的大小
  */
-static inline void _increase_block_usage_of_malloc(struct Block *block)
-{
-    // 页中block数目位的低地址block
-    struct Block *low_block = block + MALLOC_TABLE_SIZE - 1;
-    // 页中block数目位的高地址block
-    struct Block *high_block = block + MALLOC_TABLE_SIZE - 2;
-    // 加一
-    if(low_block->flags == 255)
-    {
-        high_block->flags += (1 << 6);
-    }
-    /* 
-     * 如果要是low_block->flags小于255,下面的语句是正确的
-     * 如果要是low_block->flags等于255,正确的做法是low_block->flags加一后超过表示的最大数值而往前进一
-     * 上面的语句high_block->flags += (1 << 6)相当于往前进一
-     * 且low_block->flags++后low_block->flags为256,但是由于low_block->flags是8位的,所以此时会溢出变成0
-     * 所以下面语句在low_block->flags等于255也是正确的
-     */
-    low_block->flags++; 
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, void (*ctor)(void *obj))
+{
+    if(size == 0 || size > PAGE_SIZE - CACHE_LINE_SIZE)
+        return NULL;
+    struct kmem_cache *cache = (struct kmem_cache *)malloc(sizeof(struct kmem_cache));
+    if(cache == NULL)
+        return NULL;
+    _kmem_cache_init(cache, name, size, CACHE_LINE_SIZE, ctor);
+    return cache;
 }
 
-/* 
- * 减少一个页中block使用数目 
- * 参数为页中block管理信息的初始位置
- */
-static inline void _decrease_block_usage_of_malloc(struct Block* block)
-{
-    // 页中block数目位的低地址block
-    struct Block *low_block = block + MALLOC_TABLE_SIZE - 1;
-    // 页中block数目位的高地址block
-    struct Block *high_block = block + MALLOC_TABLE_SIZE - 2;
-    // 减一
-    if(low_block->flags == 0)
-    {
-        low_block->flags = 255;
-        high_block->flags -= (1 << 6);
-    }
-    else
-    {
-        low_block->flags -= 1;
-    }
+/* 从对象缓存中分配一个对象 */
+static void *_kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct Slab *slab = cache->partial;
+    if(slab == NULL && (slab = _slab_create(cache)) == NULL)
+        return NULL;
+    void *obj = slab->freelist;
+    slab->freelist = *(void **)(obj + cache->free_offset);
+    ++slab->inuse;
+    ++cache->inuse;
+    // slab已经满了,就从partial链表中取出,直到有对象被释放再放回去
+    if(slab->freelist == NULL)
+        _slab_partial_del(slab);
+    return obj;
 }
 
-/* 
- * 获取页中使用的block的数目 
- * 参数为页中block管理信息的初始位置
- */
-static inline int _get_memory_usage_of_malloc(struct Block *block)
+void *kmem_cache_alloc(struct kmem_cache *cache)
 {
-    // 页中block数目位的低地址block
-    struct Block *low_block = block + MALLOC_TABLE_SIZE - 1;
-    // 页中block数目位的高地址block
-    struct Block *high_block = block + MALLOC_TABLE_SIZE - 2;
-    // 计算个数
-    int count = high_block->flags;
-    count = (count >> 6) << 8;
-    count += low_block->flags;
-    return count;
+    spin_lock(&_heap_lock);
+    void *obj = _kmem_cache_alloc(cache);
+    spin_unlock(&_heap_lock);
+    return obj;
 }
 
-/* 尝试去分配内存 */
-void *_try_malloc(void *p, size_t size)
+/* 将对象还给其所在的slab,对象需要是构造后的状态 */
+static void _kmem_cache_free(struct kmem_cache *cache, void *p)
 {
-    // 获取页的初始位置
-    p = _get_start_mem_by_addr(p);
-    // 获取页中block的初始位置
-    struct Block *block, *block_start;
-    block_start = block = _get_start_block_by_addr(p);
-    // 需要多少个block
-    int block_total = size / MALLOC_SIZE;
-    if(size % MALLOC_SIZE) block_total += 1;
-    if(block_total == 0) return NULL;
-    int end_index = MALLOC_TABLE_SIZE - block_total;
-    for(int i = 0; i < end_index; ++i, ++block) // 由于MALLOC_TABLE_SIZE比实际的block个数多1,而且820那个是代表的block个数,不允许分配出去,所以这里不加等于
+    struct Slab *slab = (struct Slab *)_get_start_mem_by_addr(p);
+    if(slab->cache != cache)
     {
-        if(_is_block_free(block))
-        {
-            struct Block *tmp = block;
-            int found = 1;
-            for(int j = 1; j < block_total; ++j, ++tmp)
-            {
-                if(!_is_block_free(tmp))
-                {
-                    found = 0;
-                    break;
-                }
-            }
-            if(found)
-            {
-                tmp = block;
-                _set_block_flags(block, BLOCK_FIRST);
-                for(int j = 0; j < block_total; ++j, ++tmp)
-                {
-                    _set_block_flags(tmp, BLOCK_TAKEN);
-                    // 页中block的使用数目加一
-                    _increase_block_usage_of_malloc(block_start);
-                }
-                _set_block_flags(--tmp, BLOCK_LAST);
-                return (void*)(p + i * MALLOC_SIZE);
-            }
-        }
+        panic("Memory panic: object does not belong to this cache");
+        return;
+    }
+    int was_full = (slab->freelist == NULL);
+    *(void **)(p + cache->free_offset) = slab->freelist;
+    slab->freelist = p;
+    --slab->inuse;
+    --cache->inuse;
+    if(was_full)
+        _slab_partial_add(slab);
+    // slab中的对象都空闲了,如果还有其他partial slab就把这一页还给buddy,否则留着给下次分配用,避免反复申请释放页
+    if(slab->inuse == 0 && (slab->prev || slab->next))
+    {
+        _slab_partial_del(slab);
+        _get_page_by_addr(p)->flags ^= PAGE_MALLOC;
+        --cache->slabs;
+        _page_free((void *)slab);
     }
-    return NULL;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *p)
+{
+    spin_lock(&_heap_lock);
+    _kmem_cache_free(cache, p);
+    spin_unlock(&_heap_lock);
 }
 
 /* 
  * 实现malloc
- * 在4K页内,每4字节作为一个block,4K的最后820字节作为当前页中block的管理信息
- * 前面的3276字节作为待分配的内存,3276字节共有819个block,4K共有1024个block
- * 所以将820字节的8位,加上819字节的最高2位,这样一共10位,正好能够覆盖所有的1024个block
- * 这样最后一个block的管理信息最多只能6位表示,由于管理信息具有普适性,那么所有的block的管理信息
- * 只需要最多6位即可,实际上在这个简易os上足够了
+ * 小于等于SLAB_MAX_SIZE的请求按照16/32/64/128/256/512/1024字节分成7个大小类,每个大小类有自己的对象缓存
+ * 分配时直接从该大小类缓存的partial链表的第一个slab的空闲链表中取一个对象
+ * 大于SLAB_MAX_SIZE的请求直接按照整页从buddy中分配
  */
 void *malloc(size_t size)
 {
     if(size <= 0) return NULL;
-    void *mem = NULL;
-    /* 判断待分配内存的大小 */
-    if(size <= ALLOCABLE_SIZE) // 按照malloc来分配
-    {
-        struct Page *page = (struct Page*)HEAP_START;
-        for(int i = 0; i < _num_pages; ++i, ++page)
-        {
-            // 当前页是被malloc控制的,那么就尝试在这个里面分配内存
-            if(_is_malloced(page))
-            {
-                // 获取页内存初始位置
-                mem = _get_start_mem_by_page(page);
-                // 尝试去分配block内存,成功则返回,否则就进行下一循环
-                if((mem = _try_malloc(mem, size)) != NULL) return mem;
-            }
-            else if(_is_page_free(page)) // 如果不是被malloc控制但是空闲
-            {
-                // 设置页的属性
-                _set_page_flags(page, PAGE_TAKEN | PAGE_LAST | PAGE_FIRST | PAGE_MALLOC);
-                // 获取页内存初始位置
-                mem = _get_start_mem_by_page(page);
-                // 初始化malloc管理信息
-                _malloc_init(mem);
-                // 尝试去分配block内存,成功则返回,否则就进行下一循环
-                if((mem = _try_malloc(mem, size)) != NULL) return mem;
-            }
-        }
-    }
-    else if(size > ALLOCABLE_SIZE && size <= PAGE_SIZE) // 直接按照一页来分配
-    {
-        struct Page *page = (struct Page*)HEAP_START;
-        for(int i = 0; i < _num_pages; ++i, ++page)
-        {
-            if(_is_page_free(page) && (mem = page_alloc(1))) return mem;
-        }
-    }
-    else // 前面的按照页,剩下的按照malloc分配,而且剩下的不足malloc的部分要跟前面分配的整页连续
+    void *mem;
+    spin_lock(&_heap_lock);
+    if(size <= SLAB_MAX_SIZE)
+        mem = _kmem_cache_alloc(&_kmalloc_caches[_kmalloc_class(size)]);
+    else
+        mem = _page_alloc((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if(mem)
+        ++_alloc_count;
+    else
+        ++_fail_count;
+    spin_unlock(&_heap_lock);
+    return mem;
+}
+
+/*
+ * 获取p指向的内存实际可用的字节数
+ * slab中的对象就是所在缓存的对象大小,按页分配的就是所有页的大小
+ */
+size_t malloc_usable_size(void *p)
+{
+    if(p == NULL || (reg_t)p < _alloc_start || (reg_t)p >= _alloc_end)
+        return 0;
+    reg_t idx = _get_index_by_mem(p);
+    struct Page *page = _get_page_by_index(idx);
+    size_t size = 0;
+    spin_lock(&_heap_lock);
+    if(_is_alloc_first(idx))
     {
-        int page_count = size / PAGE_SIZE;
-        int rest = size % PAGE_SIZE;
-        if(rest) page_count += 1;
-        mem = page_alloc(page_count);
-        if(rest > 0 && rest <= ALLOCABLE_SIZE && mem)
-        {
-            void *p = mem + (page_count - 1) * PAGE_SIZE;
-            _malloc_init(p);
-            struct Page *page = _get_page_by_addr(p);
-            _set_page_flags(page, PAGE_MALLOC);
-            _try_malloc(p, rest);
-        }
+        if(_is_malloced(page))
+            size = ((struct Slab *)_get_start_mem_by_addr(p))->cache->size;
+        else
+            size = (size_t)page->npages * PAGE_SIZE;
     }
-    return mem;
+    spin_unlock(&_heap_lock);
+    return size;
 }
 
 void free(void *p)
@@ -555,126 +684,80 @@ void free(void *p)
          return;
     }
 #endif
-    // 获取p所在的页
-    struct Page *page = _get_page_by_addr(p);
-    /* 
-     * 对于malloc分配的三种大情况
-     * 第一种清空页中block信息等
-     * 第二种直接page_free即可
-     * 第三种分为两种小情况:
-     *   如果最后一页不是malloc管理的,直接page_free即可
-     *   如果最后一页是malloc管理的,需要按照上面的第一种大情况来处理
-     * 基于以上分析,由于第三种大情况可能会用到第一种大情况,所以要按照以下步骤
-     * 1.应该先去判断第三种大情况,即p所在的初始page不是malloc管理的,然后清除不是malloc管理的若干页信息
-     *   1.1最后一页若也不是malloc管理的,由于page_free会将所有page清除,那么就完成了第三种大情况的第一种小情况
-     *   1.2最后一个若是malloc管理的,就需要在倒数第二页加上一个PAGE_LAST标志(这样page_free才不会直接把最后malloc管理的页清除,因为其中有可能有属于其他内存区域的内存),然后去3中清除
-     * 2.第二种大情况在1.1中就会被包含了
-     * 3.第三种大情况清除malloc管理的内存
-     */
-    if(!_is_malloced(page))
-    {
-        // 判断最后一页是不是malloc管理的
-        while(!_is_page_last(page)) ++page;
-        if(!_is_malloced(page)) //最后一页不是malloc控制的
-        {
-            page_free(p);
-            return;
-        }
-        else
-        {
-            // 设置倒数第二页为last,这样page_free就只能清除到倒数第二页
-            _set_page_flags(page - 1, PAGE_LAST);
-            page_free(p);
-            // 让p指向最后一页malloc的初始位置,因为最后malloc控制的页中的block内存必然与前面的整页内存是连续的
-            // 所以最后malloc控制的页的block初始位置也就是该页的初始位置
-            p = _get_start_mem_by_addr(p);
-        }
-    }
-    if(_is_malloced(page))
-    {
-        // 获取管理p的block
-        struct Block *block = _get_block_by_addr(p);
-        // 获取p所在页的block管理信息的初始block
-        struct Block *block_start = _get_start_block_by_addr(_get_start_mem_by_addr(p));
-
-        // 若是分配了几页连续的malloc内存A,然后从中间的某个位置B开始 free,然后下一次从B开始分配新区域
-        // 此时再去free掉A剩下的,由于此时剩下的A中的最后的block没有BLOCK_LAST标志,那么就会连同B新分配的一起free了
-        // 所以若出现从中间的某个位置B开始 free,此时B所在的block不是BLOCK_FIRST,那么就需要将前一block设置为BLOCK_LAST
-        if(!_is_block_first(block))
-        {
-            struct Block *prev_block = block - 1;
-#ifdef RV32
-            if((uint32_t)prev_block >= (uint32_t)block_start && !_is_block_free(prev_block))
-                _set_block_flags(prev_block, BLOCK_LAST);
-#else
-            if((uint64_t)prev_block >= (uint64_t)block_start && !_is_block_free(prev_block))
-                _set_block_flags(prev_block, BLOCK_LAST);
-#endif
-        }
-
-        while(!_is_block_free(block))
-        {
-            /*
-             * 最后一个block不可能是820那个
-             * 因为820那个没有管理任何block
-             * 而这个限制在malloc的_try_malloc的end_index就已经限制了
-             * 同时819那个最高两位是个数而不是属性,所以不能直接等于0
-             * 其他的block管理信息的最高两位没啥用,本来就是0
-             * 所以这里清除block信息直接低6位置0即可
-             * 但是清楚最低6位后管理信息就没了,所以要先暂存信息
-             */
-            int is_last = _is_block_last(block);
-            block->flags = (block->flags >> 6) << 6;
-            // 减少block数量
-            _decrease_block_usage_of_malloc(block_start);
-            if(is_last)
-            {
-                break;
-            }
-            ++block;
-        }
-        // 如果已经没有block在使用了,就需要清除页的PAGE_MALLOC标志,且释放掉该页内存
-        if(_get_memory_usage_of_malloc(block_start) == 0)
-        {
-            page->flags ^= PAGE_MALLOC;
-            page_free(_get_start_mem_by_page(page));
-        }
-    }
+    spin_lock(&_heap_lock);
+    ++_free_count;
+    // 获取p所在的页,被malloc管理的页是slab,否则就是按整页分配的
+    reg_t idx = _get_index_by_mem(p);
+    if(_is_alloc_first(idx) && _is_malloced(_get_page_by_index(idx)))
+        _kmem_cache_free(((struct Slab *)_get_start_mem_by_addr(p))->cache, p);
+    else
+        _page_free(p);
+    spin_unlock(&_heap_lock);
 }
 
-void *memcpy(void *dest, const void *src, size_t n)
+/*
+ * 计算最大的连续空闲页数
+ * 在_buddy_map中按字跳过没有空闲块的区域,依次找到每个空闲块,相邻的空闲块首尾相接就属于同一段连续空闲页
+ */
+static reg_t _largest_free_run()
 {
-#ifdef RV32
-    if((uint32_t)dest < _alloc_start || ((uint32_t)dest + n) > _alloc_end)
-    {
-        panic("Memcpy Panic: destination oversteps the boundary");
-        return NULL;
-    }
-#else
-    if((uint64_t)dest < _alloc_start || ((uint64_t)dest + n) > _alloc_end)
+    reg_t largest = 0;
+    reg_t run_start = 0;
+    reg_t run_end = 0;
+    reg_t idx = find_next_bit(_buddy_map, _num_pages, 0);
+    while(idx < _num_pages)
     {
-        panic("Memcpy Panic: destination oversteps the boundary");
-        return NULL;
+        reg_t end = idx + ((reg_t)1 << _get_page_by_index(idx)->order);
+        if(idx != run_end)
+            run_start = idx;
+        run_end = end;
+        if(run_end - run_start > largest)
+            largest = run_end - run_start;
+        // 空闲块内部不会有其他空闲块,所以直接从块的末尾继续找
+        idx = find_next_bit(_buddy_map, _num_pages, end);
     }
-#endif
-    if(dest == src)
-        return dest;
+    return largest;
+}
 
-    char *dp = dest;
-    const char *sp = src;
-    if(dest < src)
+/* 获取heap的统计信息,成功返回0 */
+int heap_get_stats(struct heap_stats *stats)
+{
+    if(stats == NULL)
+        return -1;
+    spin_lock(&_heap_lock);
+    stats->total_pages = _num_pages;
+    stats->used_pages = _used_pages;
+    stats->free_pages = _num_pages - _used_pages;
+    stats->max_used_pages = _max_used_pages;
+    stats->largest_free_run = _largest_free_run();
+    stats->alloc_count = _alloc_count;
+    stats->free_count = _free_count;
+    stats->fail_count = _fail_count;
+    for(int i = 0; i < SLAB_CLASS_NUM; ++i)
     {
-        while(n--)
-            *(dp++) = *(sp++);
+        struct kmem_cache *cache = &_kmalloc_caches[i];
+        stats->classes[i].size = cache->size;
+        stats->classes[i].slabs = cache->slabs;
+        stats->classes[i].inuse = cache->inuse;
+        stats->classes[i].total = cache->slabs * cache->objs;
     }
-    else
+    spin_unlock(&_heap_lock);
+    return 0;
+}
+
+/* 打印heap的统计信息 */
+void heap_print_stats()
+{
+    struct heap_stats stats;
+    heap_get_stats(&stats);
+    printf("pages: total = %d, used = %d, free = %d, max used = %d, largest free run = %d\n",
+        stats.total_pages, stats.used_pages, stats.free_pages, stats.max_used_pages, stats.largest_free_run);
+    printf("malloc: alloc = %d, free = %d, fail = %d\n", stats.alloc_count, stats.free_count, stats.fail_count);
+    for(int i = 0; i < SLAB_CLASS_NUM; ++i)
     {
-        dp += n;
-        sp += n;
-        while(n--)
-            *(--dp) = *(--sp);
+        printf("%s: slabs = %d, inuse = %d / %d\n", _kmalloc_name[i],
+            stats.classes[i].slabs, stats.classes[i].inuse, stats.classes[i].total);
     }
-    return dest;
 }
 
 void printPageInfo(struct Page * page, int pageNumToDisplay){
@@ -691,18 +774,31 @@ void printPageInfo(struct Page * page, int pageNumToDisplay){
     printf("\n");
 }
 
-void printBlockInfo(struct Block * block, int blockNumToDisplay){
-    int counter = 1;
-    for(int i = 0;i < blockNumToDisplay; i++,counter++){
-        printf("| %d ", (block+i)->flags);
-
-        // if(counter == 4)
-        //     printf("|=");
-        if(counter == 8)
-            printf("\n"); 
-        counter%=8;
+/*
+ * 大内存反复申请释放的测试,统计每次free花费的CLINT时钟数
+ * free只需要读出第一页记录的页数然后交给buddy合并,所以花费不应该随内存大小增长
+ */
+void malloc_bench()
+{
+    printf("\n\n==============> malloc_bench <==============\n\n");
+    for(int npages = 1; npages <= 256; npages <<= 1)
+    {
+        uint64_t cycles = 0;
+        for(int i = 0; i < 100; ++i)
+        {
+            void *p = malloc(npages * PAGE_SIZE);
+            if(p == NULL)
+            {
+                printf("malloc failed\n");
+                return;
+            }
+            uint64_t start = timer_mtime();
+            free(p);
+            cycles += timer_mtime() - start;
+        }
+        printf("free %d pages: %d cycles per 100 ops\n", npages, (int)cycles);
     }
-    printf("\n");
+    printf("\n\n==============> END malloc_bench <==============\n\n");
 }
 
 void page_test()
@@ -781,121 +877,43 @@ void malloc_test()
     
     page_init();
     
-    printf("most operation are in first Pages\n");
-
     struct Page *page = (struct Page *)HEAP_START;
-    void * page1Mem = (void*)_alloc_start;
-    struct Block * mallocTable = _get_start_block_by_addr(page1Mem);
-    printf("page1 = 0x%x\n", page1Mem);
-    printf("Page Table:\n");
-    printBlockInfo(mallocTable, 8);
 
-    printf("void * page1 = page_alloc(1);\n");
-    void * page1 = page_alloc(1);
-    printf("page1 = 0x%x\n", page1);
+    printf("void * p1 = malloc(sizeof(char));\n");
+    void * p1 = malloc(sizeof(char));
+    printf("p1 = 0x%x\n", p1);
     printf("Page Table:\n");
     printPageInfo(page,16);
 
-    printf("void * page2 = page_alloc(1);\n");
-    void * page2 = page_alloc(1);
-    printf("page2 = 0x%x\n", page2);
-    printf("Page Table:\n");
-    printPageInfo(page,16);
+    printf("void * p2 = malloc(sizeof(int) * 5);\n");
+    void * p2 = malloc(sizeof(int) * 5);
+    printf("p2 = 0x%x\n", p2);
 
-    printf("free(page1);\n");
-	free(page1);
-    printf("Page Table:\n");
-    printPageInfo(page,16);
-    
-    printf("void * p1 = malloc(sizeof(char));\n");
-    void * p1 = malloc(sizeof(char));
-    printf("p1 = 0x%x\n", p1);
+    printf("void * p3 = malloc(sizeof(char));\n");
+    void * p3 = malloc(sizeof(char));
+    printf("p3 = 0x%x, p3 - p1 = %d\n", p3, p3 - p1);
     printf("Page Table:\n");
     printPageInfo(page,16);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
 
     printf("free(p1);\n");
     free(p1);
-    printf("Page Table:\n");
-    printPageInfo(page,16);
+    printf("void * p4 = malloc(sizeof(short));\n");
+    void * p4 = malloc(sizeof(short));
+    printf("p4 = 0x%x, p4 == p1: %d\n", p4, p4 == p1);
 
-    printf("void * p2 = malloc(sizeof(short));\n");
-    void * p2 = malloc(sizeof(short));
-    printf("p2 = 0x%x\n", p2);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("void * p3 = malloc(sizeof(int));\n");
-    void * p3 = malloc(sizeof(int));
-    printf("p3 = 0x%x\n", p3);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("void * p4 = malloc(sizeof(long long int));\n");
-    void * p4 = malloc(sizeof(long long int));
-    printf("p4 = 0x%x\n", p4);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("void * p5 = malloc(sizeof(long double));\n");
-    void * p5 = malloc(sizeof(long double));
+    printf("void * p5 = malloc(sizeof(int) * 4000);\n");
+    void * p5 = malloc(sizeof(int) * 4000);
     printf("p5 = 0x%x\n", p5);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("free(p5+4);\n");
-    free(p5+4);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("free(p4+4);\n");
-    free(p4+4);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("void * p6 = malloc(sizeof(int));\n");
-    void * p6 = malloc(sizeof(int));
-    printf("p6 = 0x%x\n", p6);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    printf("void * p7 = malloc(sizeof(int)*819);\n");
-    void * p7 = malloc(sizeof(int)*819);
-    printf("p7 = 0x%x\n", p7);
-    printf("Page Table:\n");
-    printPageInfo(page,16);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
-    free(p7+sizeof(int)*818);
-    printf("free(p7+sizeof(int)*818);\n");
-    void *tmp = (void *)(_alloc_start + (PAGE_SIZE * 2));
-    printBlockInfo(_get_start_block_by_addr(tmp)+800, 20);
-    printf("memory usage ==> %d\n", _get_memory_usage_of_malloc(_get_start_block_by_addr(tmp)));
- 
-    
-    printf("void * p8 = malloc(sizeof(int)*4000);\n");
-    void * p8 = malloc(sizeof(int)*4000);
-    printf("p8 = 0x%x\n", p8);
-    printf("Page Table:\n");
-    printPageInfo(page,16);
-
-    printf("free(p8+4096);\n");
-    page_free(p8+4096);
     printf("Page Table:\n");
     printPageInfo(page,16);
 
-    printf("free(p8);\n");
-    page_free(p8);
+    printf("free(p2); free(p3); free(p4); free(p5);\n");
+    free(p2);
+    free(p3);
+    free(p4);
+    free(p5);
     printf("Page Table:\n");
     printPageInfo(page,16);
 
-    printf("void * p9 = malloc(sizeof(int));\n");
-    void * p9 = malloc(sizeof(int));
-    printf("p9 = 0x%x\n", p9);
-    printf("malloc Table:\n");
-    printBlockInfo(mallocTable, 40);
-
     printf("\n\n==============> END malloc_test <==============\n\n"); 
-}
\ No newline at end of file
+}
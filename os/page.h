@@ -0,0 +1,37 @@
+#ifndef __PAGE_H__
+#define __PAGE_H__
+
+#include "type.h"
+
+#define PAGE_SIZE 4096
+
+/* 用于4K对齐,4K是2的12次方,对齐方式见函数_align_page */
+#define PAGE_ORDER 12
+
+/* malloc的大小类个数,从16字节到1024字节 */
+#define SLAB_CLASS_NUM 7
+
+/* malloc每个大小类的使用情况 */
+struct slab_class_stats
+{
+    uint32_t size; // 对象大小
+    uint32_t slabs; // slab个数,每个slab占一页
+    uint32_t inuse; // 已分配出去的对象个数
+    uint32_t total; // 所有slab中的对象总个数
+};
+
+/* heap的统计信息,页数都是4K页的个数 */
+struct heap_stats
+{
+    uint32_t total_pages; // 可分配的总页数
+    uint32_t free_pages; // 空闲页数
+    uint32_t used_pages; // 已分配页数,包括slab占用的页
+    uint32_t max_used_pages; // 已分配页数的最高值
+    uint32_t largest_free_run; // 最大的连续空闲页数
+    uint32_t alloc_count; // malloc成功的次数
+    uint32_t free_count; // free的次数
+    uint32_t fail_count; // malloc失败的次数
+    struct slab_class_stats classes[SLAB_CLASS_NUM];
+};
+
+#endif
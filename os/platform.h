@@ -7,6 +7,12 @@
 /* cpu个数 */
 #define MAXNUM_CPU 8
 
+/* 每个hart的trap栈大小,trap_handler以及其中调用的调度、定时器、系统调用等内核代码都在trap栈上执行 */
+#define TRAP_STACK_SIZE 4096
+
+/* cache line大小 */
+#define CACHE_LINE_SIZE 64
+
 /* uart0的物理地址 */
 #define UART0 0x10000000L
 
@@ -32,14 +38,18 @@
  * #define VIRT_PLIC_SIZE(__num_context) \
  *     (VIRT_PLIC_CONTEXT_BASE + (__num_context) * VIRT_PLIC_CONTEXT_STRIDE)
  */
-/* 设置plic_base地址,以下宏都是Machine模式下的 */
+/*
+ * 设置plic_base地址,以下宏都是Machine模式下的
+ * qemu virt中每个hart有M和S两个context,hart i的M模式context编号为2 * i
+ * 每个context的enable寄存器间隔0x80,threshold和claim寄存器间隔0x1000
+ */
 #define PLIC_BASE 0x0c000000L
 #define PLIC_PRIORITY(interrupt_id) (PLIC_BASE + (interrupt_id) * 4)
 #define PLIC_PENDING(interrupt_id) (PLIC_BASE + 0x1000 + ((interrupt_id) / 32) * 4)
-#define PLIC_MENABLE(hart_id) (PLIC_BASE + 0x2000 + (hart_id) * 0x80)
-#define PLIC_MTHRESHOLD(hart_id) (PLIC_BASE + 0x200000 + (hart_id) * 0x100)
-#define PLIC_MCLAIM(hart_id) (PLIC_BASE + 0x200004 + (hart_id) * 0x1000)
-#define PLIC_MCOMPLETE(hart_id) (PLIC_BASE + 0x200004 + (hart_id) * 0x1000)
+#define PLIC_MENABLE(hart_id) (PLIC_BASE + 0x2000 + (hart_id) * 0x100)
+#define PLIC_MTHRESHOLD(hart_id) (PLIC_BASE + 0x200000 + (hart_id) * 0x2000)
+#define PLIC_MCLAIM(hart_id) (PLIC_BASE + 0x200004 + (hart_id) * 0x2000)
+#define PLIC_MCOMPLETE(hart_id) (PLIC_BASE + 0x200004 + (hart_id) * 0x2000)
 
 /*
  * The Core Local INTerruptor (CLINT) block holds memory-mapped control and
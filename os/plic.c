@@ -1,10 +1,10 @@
 #include "os.h"
 
-/* 初始化plic,os运行在machine模式,所以下面的设置都是针对machine模式 */
+/* 初始化plic,os运行在machine模式,所以下面的设置都是针对machine模式,每个hart都要初始化自己的context */
 void plic_init()
 {
     // 读取hart id,用于开启中断、设置优先级等
-    reg_t hart_id = r_tp();
+    reg_t hart_id = r_mhartid();
 
     // 设置uart代表的中断源等级为1,等级范围为1-7,数字越大等级越高,0代表该中断源被关闭
     *((uint32_t*)(PLIC_PRIORITY(UART0_IRQ))) = 1;
@@ -26,7 +26,7 @@ void plic_init()
 /* 返回plic中当前优先级最高的中断源id */
 int plic_claim()
 {
-    reg_t hart_id = r_tp();
+    reg_t hart_id = r_mhartid();
     int irq = *((uint32_t*)(PLIC_MCLAIM(hart_id)));
     return irq;
 }
@@ -34,6 +34,6 @@ int plic_claim()
 /* 告知plic某中断源的中断已经处理完成 */
 void plic_complete(int irq)
 {
-    reg_t hart_id = r_tp();
+    reg_t hart_id = r_mhartid();
     *((uint32_t*)(PLIC_MCOMPLETE(hart_id))) = irq;
 }
\ No newline at end of file
@@ -27,6 +27,7 @@ static int _vsnprintf(char * out, size_t n, const char* s, va_list vl) {
                 }
                 int digits = 0; // num是几位数,如三位数、四位数等
                 for (long i = num; i != 0; i /= 10, ++digits);
+                if(digits == 0) digits = 1; // num为0时也要打印一个0
                 for (int i = digits - 1; i >= 0; --i)
                 {
                     if(out && pos + i < n)
@@ -95,11 +96,23 @@ static int _vsnprintf(char * out, size_t n, const char* s, va_list vl) {
                 format = 0;
                 break;
             }
-            case 'c': // %c
+            case 'c': // %c,char作为可变参数时会提升为int
             {
+                char c = (char)va_arg(vl, int);
                 if(out && pos < n)
                 {
-                    out[pos] = *s;
+                    out[pos] = c;
+                }
+                ++pos;
+                longarg = 0;
+                format = 0;
+                break;
+            }
+            case '%': // %%输出一个%
+            {
+                if(out && pos < n)
+                {
+                    out[pos] = '%';
                 }
                 ++pos;
                 longarg = 0;
@@ -134,18 +147,33 @@ static int _vsnprintf(char * out, size_t n, const char* s, va_list vl) {
     return pos;
 }
 
+/* 多个hart共用out_buf和uart,打印时需要加锁,否则输出会互相覆盖 */
+static struct spinlock _printf_lock;
+
+/* 在第一次printf之前由hart 0调用 */
+void printf_init()
+{
+    spin_init(&_printf_lock, "printf");
+}
+
 static int _vprintf(const char *s, va_list vl)
 {
     // 获取格式化之后的打印字符串的总长度(不包括最后的0)
     // 格式化之后的打印字符串的总长度是指将%d等格式已经转换为具体数字或字符之后的总长度(不包括最后的0)
-    int res = _vsnprintf(NULL, -1, s, vl);
+    // 两遍都要从头读取参数,va_list读过之后不能再用,所以第一遍用一份拷贝
+    va_list vl_len;
+    va_copy(vl_len, vl);
+    int res = _vsnprintf(NULL, -1, s, vl_len);
+    va_end(vl_len);
     if(res + 1 >= sizeof(out_buf)) //需要将最后的0也放入到out_buf中,所以res要+1
     {
         uart_puts("error: output string size overflow\n");
         while(1);
     }
+    spin_lock(&_printf_lock);
     _vsnprintf(out_buf, res + 1, s, vl);
     uart_puts(out_buf);
+    spin_unlock(&_printf_lock);
     return res;
 }
 
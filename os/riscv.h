@@ -41,6 +41,14 @@ static inline void w_mie(reg_t val)
     asm volatile ("csrw mie, %0" : : "r"(val));
 }
 
+/* 读取当前hart的id,任务的tp会随上下文切换,所以内核中用mhartid来确定当前所在的hart */
+static inline reg_t r_mhartid()
+{
+    reg_t val;
+    asm volatile ("csrr %0, mhartid" : "=r"(val));
+    return val;
+}
+
 /* 读取mstatus寄存器的值 */
 static inline reg_t r_mstatus()
 {
@@ -55,4 +63,18 @@ static inline void w_mstatus(reg_t val)
     asm volatile ("csrw mstatus, %0" : : "r"(val));
 }
 
+/* 读取mscratch寄存器的值,即trap时保存上下文的地址 */
+static inline reg_t r_mscratch()
+{
+    reg_t val;
+    asm volatile ("csrr %0, mscratch" : "=r"(val));
+    return val;
+}
+
+/* 设置mscratch寄存器的值 */
+static inline void w_mscratch(reg_t val)
+{
+    asm volatile ("csrw mscratch, %0" : : "r"(val));
+}
+
 #endif
\ No newline at end of file
@@ -1,175 +1,677 @@
 #include "os.h"
 
-/* _tasks_num表示当前执行的任务数量,包括正在执行和被切换下去的任务 */
-static int _tasks_num = 0;
+/* 每个hart的调度状态 */
+struct cpu cpus[MAXNUM_CPU];
+/* 每个hart的内核任务的栈 */
+static uint8_t _os_stack[MAXNUM_CPU][STACK_SIZE] __attribute__((aligned(16)));
+/* 保护空闲栈池和task id,就绪队列由每个hart自己的锁保护 */
+static struct spinlock _sched_lock;
 /* 每次生成新任务时的task id */
 static int _task_id = 1;
-/* cur_task表示当前task */
-struct taskInfo *cur_task = NULL;
-/* first_task表示第一个task,也就是优先级最高的task */
-struct taskInfo *first_task = NULL;
+/* 每个优先级一个先进先出的双向链表 */
+struct run_queue
+{
+    struct taskInfo *head;
+    struct taskInfo *tail;
+};
+/*
+ * 每个hart自己的就绪队列,正在运行和睡眠的任务不在就绪队列中
+ * prio_map中第i位为1表示优先级i的队列不为空,优先级数值越小越高,所以第一个为1的位就是最高优先级
+ * 本hart从最高优先级队列的头部取任务,其他空闲的hart从最低优先级队列的尾部偷任务,两端互不干扰
+ * 任务的状态(RUNNABLE/SLEEPING/EXITED)由任务所在hart(task->cpu)的就绪队列的锁保护
+ */
+struct rq
+{
+    struct spinlock lock;
+    struct run_queue queue[MAX_PRIORITY];
+    reg_t prio_map[MAX_PRIORITY / BITS_PER_REG];
+    volatile int nr_running; // 就绪队列中的任务数量,其他hart选择偷取对象时不加锁读取
+};
+static struct rq _rqs[MAXNUM_CPU];
+/* 第i位为1表示hart i没有任务可运行,正在(或即将)wfi,放入任务后需要用软中断唤醒它 */
+static volatile reg_t _idle_mask = 0;
+/*
+ * 保护每个hart的idle_time,由该hart在cpu_idle中写,sched_print_stats在其他hart上读
+ * RV32下64位的读写要分两次,不加保护可能读到一半新一半旧的值
+ */
+static struct seqlock _idle_seq[MAXNUM_CPU];
+#ifdef CONFIG_BENCH
+/* 置1时下一次schedule先回到内核任务,由内核任务task_yield再调度,用于和直接切换对比 */
+static volatile int _bench_bounce[MAXNUM_CPU];
+#endif
+/* taskInfo的对象缓存 */
+static struct kmem_cache *_task_cache = NULL;
+
+/*
+ * 空闲栈池,任务退出后栈先放到池中,后面创建任务时优先复用,不用每次都走malloc
+ * 链表节点直接放在空闲栈的栈底,复用时会重新写入canary,由_sched_lock保护
+ */
+struct stack_node
+{
+    struct stack_node *next;
+    uint32_t size;
+};
+static struct stack_node *_stack_pool = NULL;
+static int _stack_pool_num = 0;
+/* 空闲栈池最多缓存的栈的个数,超过后直接free */
+#define STACK_POOL_MAX 32
+
+/* 分配size字节的任务栈,先从空闲栈池中找大小相同的栈 */
+static uint8_t *_stack_alloc(uint32_t size)
+{
+    struct stack_node *prev = NULL;
+    struct stack_node *it = _stack_pool;
+    while(it && it->size != size)
+    {
+        prev = it;
+        it = it->next;
+    }
+    if(it == NULL)
+        return (uint8_t *)malloc(size);
+    if(prev == NULL)
+        _stack_pool = it->next;
+    else
+        prev->next = it->next;
+    --_stack_pool_num;
+    return (uint8_t *)it;
+}
+
+/* 释放任务栈,空闲栈池没满就放入池中 */
+static void _stack_free(uint8_t *stack, uint32_t size)
+{
+    if(_stack_pool_num >= STACK_POOL_MAX)
+    {
+        free(stack);
+        return;
+    }
+    struct stack_node *node = (struct stack_node *)stack;
+    node->size = size;
+    node->next = _stack_pool;
+    _stack_pool = node;
+    ++_stack_pool_num;
+}
 
-/*  设置mscratch寄存器的值 */
-static void w_mscratch(reg_t val)
+/* 在栈底写入canary */
+static void _stack_set_canary(uint8_t *stack)
 {
-    asm volatile("csrw mscratch, %0" : : "r"(val));
+    reg_t *canary = (reg_t *)stack;
+    for(int i = 0; i < STACK_CANARY_WORDS; ++i)
+        canary[i] = STACK_CANARY;
 }
 
-/* 调度初始化 */
+/* 检查栈底的canary是否被改写,没有MMU做不了不可访问的保护页,只能在任务切换时检查 */
+static void _stack_check(struct taskInfo *task)
+{
+    reg_t *canary = (reg_t *)task->stack;
+    for(int i = 0; i < STACK_CANARY_WORDS; ++i)
+    {
+        if(canary[i] != STACK_CANARY)
+        {
+            printf("task %d: ", task->task_id);
+            panic("Stack Panic: task stack overflow");
+        }
+    }
+}
+
+/* 回收已经退出的任务的栈和taskInfo,调用时不能运行在该任务的栈上,也不能持有_sched_lock */
+static void _free_task(struct taskInfo *task)
+{
+    _stack_check(task);
+    // 空闲栈池和task_create共用,其他hart可能同时在分配
+    spin_lock(&_sched_lock);
+    _stack_free(task->stack, task->stack_size);
+    spin_unlock(&_sched_lock);
+    kmem_cache_free(_task_cache, (void *)task);
+}
+
+/* 调度初始化,只由hart 0调用一次,初始化所有hart共享的数据 */
 void sched_init()
 {
+    spin_init(&_sched_lock, "sched");
+    for(int i = 0; i < MAXNUM_CPU; ++i)
+    {
+        spin_init(&_rqs[i].lock, "rq");
+        seqlock_init(&_idle_seq[i], "idle");
+    }
+    // 创建taskInfo的对象缓存,任务的创建和退出不再走malloc
+    _task_cache = kmem_cache_create("taskInfo", sizeof(struct taskInfo), NULL);
+    sched_init_hart();
+}
+
+/* 每个hart的调度初始化,初始化当前hart的内核任务 */
+void sched_init_hart()
+{
+    reg_t hart_id = r_mhartid();
+    struct cpu *c = mycpu();
     // 首先设置mscratch寄存器的值为0,任务调度在schedule执行
     w_mscratch(0);
+    c->cur_task = NULL;
     // 初始化内核任务
-    os_task.task_id = 0;
-    os_task.priority = 0;
-    os_task.state = RUNNING; // os的任务一直执行,所以一直是RUNNING
-    os_task.timeslice = 0xffffffff;
-    os_task.next = NULL;
-    os_task.ctx.sp = (reg_t)(&(os_stack[STACK_SIZE - 1]));
-    os_task.ctx.pc = (reg_t)kernel; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
+    c->os_task.task_id = 0;
+    c->os_task.priority = 0;
+    c->os_task.state = RUNNING; // os的任务一直执行,所以一直是RUNNING
+    c->os_task.timeslice = 0xffffffff;
+    c->os_task.next = NULL;
+    c->os_task.ctx.sp = (reg_t)(_os_stack[hart_id] + STACK_SIZE);
+    c->os_task.ctx.pc = (reg_t)kernel; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
+    c->steals = 0;
+    c->migrations = 0;
+    c->idle_time = 0;
+    c->start_time = timer_mtime();
+    c->started = 1;
     // 设置mie寄存器中软件定时器开启
     w_mie(r_mie() | MIE_MSIE);
 }
 
-/* 插入新任务到链表 */
-int insert_task(struct taskInfo * new_task)
+/* 将任务插入到rq中其优先级队列的末尾,需要持有rq->lock */
+static void insert_task(struct rq *rq, struct taskInfo *new_task)
 {
-    // 现在还没有任务
-    if(first_task == NULL && _tasks_num == 0)
-    {
-        first_task = new_task;
-        ++_tasks_num;
-        return 0;
-    }
-    // 现在有了任务,但是first_task为空
-    if(first_task == NULL) return -1;
-    // 从前往后找进行插入,优先级相同的话按照先进先出的原则
-    // 先判断是否是开头
-    if(new_task->priority < first_task->priority)
-    {
-        new_task->next = first_task;
-        first_task = new_task;
-    }
+    if(new_task->priority < 0)
+        new_task->priority = 0;
+    else if(new_task->priority >= MAX_PRIORITY)
+        new_task->priority = MAX_PRIORITY - 1;
+    struct run_queue *q = &rq->queue[new_task->priority];
+    new_task->next = NULL;
+    new_task->prev = q->tail;
+    if(q->tail)
+        q->tail->next = new_task;
     else
-    {
-        struct taskInfo *it = first_task;
-        struct taskInfo *prev = first_task;
-        while(it && new_task->priority >= it->priority)
-        {
-            prev = it;
-            it = it->next;
-        }
+        q->head = new_task;
+    q->tail = new_task;
+    set_bit(rq->prio_map, new_task->priority);
+    ++rq->nr_running;
+}
 
-        prev->next = new_task;
-        new_task->next = it;
+/* 将任务从rq中其优先级队列中摘下,队列空了就清除位图中对应的位,需要持有rq->lock */
+static void remove_task(struct rq *rq, struct taskInfo *task)
+{
+    struct run_queue *q = &rq->queue[task->priority];
+    if(task->prev)
+        task->prev->next = task->next;
+    else
+        q->head = task->next;
+    if(task->next)
+        task->next->prev = task->prev;
+    else
+        q->tail = task->prev;
+    task->next = task->prev = NULL;
+    if(q->head == NULL)
+        clear_bit(rq->prio_map, task->priority);
+    --rq->nr_running;
+}
+
+/*
+ * 任务在now从hart上切换下来,把这次运行的时间计入总运行时间和当前时间片
+ * 主动让出的任务下次只能运行时间片剩下的部分,用完了才开始新的时间片
+ */
+static void _task_account(struct taskInfo *task, uint64_t now)
+{
+    uint64_t delta = now - task->switch_in;
+    task->runtime += delta;
+    task->slice_used += delta;
+    if(task->slice_used >= TASK_SLICE_MTIME(task))
+        task->slice_used = 0;
+}
+
+/*
+ * 将要在当前hart上运行的任务设置为运行状态,需要持有任务所在rq的锁
+ * 降低优先级,等任务被切换下来时再放到对应队列的末尾,否则就只能一直高优先级执行了
+ * 任务上次不是在当前hart上运行的,就记一次迁移
+ */
+static void _task_run(struct cpu *c, int hart, struct taskInfo *task)
+{
+    if(task->priority < MAX_PRIORITY - 1)
+        task->priority++;
+    task->state = RUNNING;
+    task->on_cpu = 1;
+    if(task->cpu != hart)
+    {
+        task->cpu = hart;
+        ++c->migrations;
     }
-    ++_tasks_num;
-    return 0;
 }
 
-/* 从任务链表中取得一个任务 */
-struct taskInfo *pop_task()
+/* 从本hart的就绪队列中取出优先级最高的任务,位图只有几个字,所以和任务个数无关,需要持有rq->lock */
+static struct taskInfo *pop_task(struct rq *rq)
 {
-    if(first_task == NULL)
+    reg_t prio = find_next_bit(rq->prio_map, MAX_PRIORITY, 0);
+    if(prio >= MAX_PRIORITY)
         return NULL;
-    struct taskInfo *task = first_task;
-    struct taskInfo *prev = first_task;
-    while(task && task->state == SLEEPING)
+    struct taskInfo *task = rq->queue[prio].head;
+    remove_task(rq, task);
+    return task;
+}
+
+/*
+ * 本hart没有就绪任务时,从就绪任务最多的hart偷一个任务
+ * 偷的是最低优先级队列尾部的任务,也就是对方最晚才会运行的任务
+ * 调用时不能持有任何就绪队列的锁,否则两个hart互相偷的时候会死锁
+ */
+static struct taskInfo *steal_task(struct cpu *c, int hart)
+{
+    int victim = -1;
+    int max = 0;
+    for(int i = 0; i < MAXNUM_CPU; ++i)
     {
-        prev = task;
-        task = task->next;
+        if(i != hart && _rqs[i].nr_running > max)
+        {
+            max = _rqs[i].nr_running;
+            victim = i;
+        }
     }
-    if(task == NULL)
+    if(victim < 0)
         return NULL;
-    
-    if(task->priority < 256)
-        task->priority++; //减小优先级,否则就只能一直高优先级执行了
-    
-    // 将任务拿出来,降低优先级后再放到任务链表中
-    if(task->task_id == first_task->task_id)
-        first_task = first_task->next;
-    else
-        prev->next = task->next;
-
-    //减小数量,然后重新插入
-    --_tasks_num;
-    insert_task(task);
+    struct rq *rq = &_rqs[victim];
+    struct taskInfo *task = NULL;
+    spin_lock(&rq->lock);
+    // 加锁之前读取的nr_running可能已经变了,所以还要再检查一次
+    reg_t prio = find_prev_bit(rq->prio_map, MAX_PRIORITY - 1);
+    if(prio != (reg_t)-1)
+    {
+        task = rq->queue[prio].tail;
+        remove_task(rq, task);
+        _task_run(c, hart, task);
+        ++c->steals;
+    }
+    spin_unlock(&rq->lock);
     return task;
 }
 
-/* 用户任务调度函数 */
-void schedule()
+/*
+ * 任务放入hart的就绪队列后调用,需要在释放rq->lock之后调用
+ * 该hart空闲就唤醒它,否则唤醒另外一个空闲的hart,让它来偷任务
+ */
+static void _kick_idle(int hart)
+{
+    __sync_synchronize();
+    reg_t idle = _idle_mask;
+    if(idle == 0)
+        return;
+    if(!(idle & ((reg_t)1 << hart)))
+        hart = ctz(idle);
+    *((uint32_t*)CLIENT_MSIP(hart)) = 1;
+}
+
+/*
+ * 唤醒睡眠或阻塞的任务,重新放入其所在hart的就绪队列
+ * 任务可能刚进入睡眠还没有在原来的hart上切换下来,这时只修改状态,由那个hart的schedule放回就绪队列
+ */
+void task_wakeup(struct taskInfo *task)
 {
-    if(_tasks_num <= 0)
+    struct rq *rq;
+    // 睡眠的任务不在任何就绪队列中,不会被偷走,task->cpu只会在被取出运行时改变,所以最多重试一次
+    while(1)
+    {
+        rq = &_rqs[task->cpu];
+        spin_lock(&rq->lock);
+        if(rq == &_rqs[task->cpu])
+            break;
+        spin_unlock(&rq->lock);
+    }
+    int inserted = 0;
+    if(task->state == SLEEPING || task->state == BLOCKED)
     {
+        task->state = RUNNABLE;
+        if(!task->on_cpu)
+        {
+            insert_task(rq, task);
+            inserted = 1;
+        }
+    }
+    spin_unlock(&rq->lock);
+    if(inserted)
+        _kick_idle(rq - _rqs);
+}
+
+/*
+ * 用户任务调度函数,在trap中或者主动让出时执行
+ * 被切换下来的任务的上下文已经在trap_vector或switch_yield中保存好了,并且当前运行在trap栈上
+ * 所以可以把它放回本hart的就绪队列,其他空闲的hart也可以把它偷走,已经退出的任务也可以直接回收
+ * voluntary为0表示是被抢占的,这时阻塞状态的任务还没来得及调用task_yield,要当作被唤醒放回就绪队列,
+ * 否则它在设置阻塞状态之后、检查等待条件之前被抢占的话就再也没有机会检查了,所以等待的任务被唤醒后都要重新检查条件
+ */
+static void _schedule(int voluntary)
+{
+    struct cpu *c = mycpu();
+    int hart = r_mhartid();
+    struct rq *rq = &_rqs[hart];
+    struct taskInfo *prev = c->cur_task;
+    struct taskInfo *exited = NULL;
+#ifdef CONFIG_BENCH
+    if(_bench_bounce[hart])
+    {
+        _bench_bounce[hart] = 0;
         back_os();
-        // panic("Num of task should be greater than zero!");
-        return;
     }
-    // 获取要调度的task Id,下一个执行任务都是当前执行任务的下一个id,不执行的任务都被切换到了内存中
-    // 所以这里不会乱,会按照任务的索引依次循环执行
-    if((cur_task = pop_task()) == NULL)
+#endif
+    uint64_t now = timer_mtime();
+    spin_lock(&rq->lock);
+    if(prev != NULL)
+    {
+        c->cur_task = NULL;
+        _task_account(prev, now);
+        prev->on_cpu = 0;
+        if(prev->state == EXITED)
+        {
+            exited = prev;
+        }
+        else
+        {
+            _stack_check(prev);
+            if(prev->state == BLOCKED && !voluntary)
+                prev->state = RUNNABLE;
+            // 睡眠和阻塞的任务不放回,由定时器或者task_wakeup唤醒时放回
+            if(prev->state != SLEEPING && prev->state != BLOCKED)
+            {
+                prev->state = RUNNABLE;
+                insert_task(rq, prev);
+            }
+        }
+    }
+    // 取出本hart优先级最高的就绪任务
+    struct taskInfo *next = pop_task(rq);
+    if(next != NULL)
+        _task_run(c, hart, next);
+    spin_unlock(&rq->lock);
+    if(exited != NULL)
+        _free_task(exited);
+    // 本hart没有就绪任务就去别的hart偷,还是没有就回到内核任务
+    if(next == NULL && (next = steal_task(c, hart)) == NULL)
     {
         back_os();
         panic("After back_os: never be here");
         return;
     }
-    struct context *next = &(cur_task->ctx);
-    switch_to(next);
+    c->cur_task = next;
+    // 开始运行时间片剩下的部分,mtimecmp设置为时间片结束和其他截止时间中最早的
+    next->switch_in = timer_mtime();
+    timer_slice_start(next);
+    irqoff_end();
+    switch_to(&(next->ctx));
+}
+
+/* 中断和异常的trap中调用 */
+void schedule()
+{
+    _schedule(0);
+}
+
+/* 主动让出时由switch_yield调用 */
+void schedule_yield()
+{
+    _schedule(1);
+}
+
+/* 当前hart上正在运行的任务,内核任务返回NULL */
+struct taskInfo *task_self()
+{
+    push_off();
+    struct taskInfo *task = mycpu()->cur_task;
+    pop_off();
+    return task;
+}
+
+/* 当前任务累计运行的纳秒数,包括这次切换进来之后运行的时间 */
+uint64_t task_runtime_ns()
+{
+    push_off();
+    struct taskInfo *task = mycpu()->cur_task;
+    uint64_t runtime = 0;
+    if(task != NULL)
+        runtime = task->runtime + timer_mtime() - task->switch_in;
+    pop_off();
+    return timer_mtime_to_ns(runtime);
+}
+
+/* 计算a占b的百分比,RV32下不能用64位除法,先把两个数一起右移到32位以内 */
+static int _percent(uint64_t a, uint64_t b)
+{
+    while(b >> 24)
+    {
+        a >>= 1;
+        b >>= 1;
+    }
+    if(b == 0)
+        return 0;
+    return (uint32_t)a * 100 / (uint32_t)b;
 }
 
-/* 切换下一个用户任务 */
+/* 打印每个hart的偷取任务次数、任务迁移到该hart的次数以及空闲和忙碌时间的占比 */
+void sched_print_stats()
+{
+    uint64_t now = timer_mtime();
+    for(int i = 0; i < MAXNUM_CPU; ++i)
+    {
+        if(!cpus[i].started)
+            continue;
+        uint64_t idle_time;
+        uint32_t seq;
+        do
+        {
+            seq = read_seqbegin(&_idle_seq[i]);
+            idle_time = cpus[i].idle_time;
+        } while(read_seqretry(&_idle_seq[i], seq));
+        int idle = _percent(idle_time, now - cpus[i].start_time);
+        printf("hart %d: runnable = %d, steals = %d, migrations = %d, idle = %d%%, busy = %d%%\n",
+            i, _rqs[i].nr_running, cpus[i].steals, cpus[i].migrations, idle, 100 - idle);
+#ifdef CONFIG_IRQSTAT
+        printf("hart %d: max interrupts-off = %d ns\n", i, (int)timer_mtime_to_ns(cpus[i].irqoff_max));
+#endif
+    }
+}
+
+/*
+ * 内核任务发现没有任务可运行时调用,让hart进入wfi等待中断,代替不停地task_yield空转
+ * 先把定时器设置为下一个需要处理的时间,hart 0是最近的软件定时器到期的时间,其他hart不需要定时器中断
+ * 其他hart放入任务时通过_idle_mask发现这个hart空闲,用软中断唤醒它
+ */
+void cpu_idle()
+{
+    // 内核任务不会在hart之间迁移,mycpu不会变
+    struct cpu *c = mycpu();
+    int hart = r_mhartid();
+    // 关中断后wfi,中断到来时wfi返回但不会进入trap,统计完空闲时间再打开中断处理
+    // 如果先打开中断再wfi,中断在两者之间到来的话就要等下一个中断才能醒来
+    w_mstatus(r_mstatus() & ~MSTATUS_MIE);
+    __sync_fetch_and_or(&_idle_mask, (reg_t)1 << hart);
+    // 设置_idle_mask之后再检查一次,防止其他hart在检查之前放入了任务但是没看到空闲标记
+    // 当前任务不为空说明内核任务是被临时切换回来的,也不能睡眠
+    int busy = c->cur_task != NULL;
+    for(int i = 0; i < MAXNUM_CPU && !busy; ++i)
+        busy = _rqs[i].nr_running > 0;
+    if(!busy)
+    {
+        timer_idle_enter();
+        uint64_t start = timer_mtime();
+        asm volatile("wfi");
+        uint64_t end = timer_mtime();
+        write_seqlock(&_idle_seq[hart]);
+        c->idle_time += end - start;
+        write_sequnlock(&_idle_seq[hart]);
+        timer_idle_exit();
+    }
+    __sync_fetch_and_and(&_idle_mask, ~((reg_t)1 << hart));
+    // 打开中断后等待的中断会马上进入trap,由schedule切换到新的任务
+    w_mstatus(r_mstatus() | MSTATUS_MIE);
+}
+
+/*
+ * 主动让出hart,切换下一个任务
+ * 和函数调用一样,调用方已经默认t0-t6、a0-a7会被改掉,所以只需要由switch_yield保存ra、sp和s0-s11,
+ * 不需要像抢占时那样通过软中断进入trap_vector保存全部寄存器
+ * 只能在任务或内核任务中调用,在trap中要用task_resched
+ */
 void task_yield()
 {
-    // 抢占式系统中,任务要想主动放弃hart,需要生成软中断
-    reg_t hart_id = r_tp();
-    *((uint32_t*)CLIENT_MSIP(hart_id)) = 1;
+    // 关中断,保存上下文并切换到trap栈之前不能被定时器中断打断,之后读取mycpu()也不会被迁移到别的hart
+    w_mstatus(r_mstatus() & ~MSTATUS_MIE);
+    // push_off的嵌套深度记录在hart上,带着它切换走的话,这个hart和任务之后运行的hart的计数就都不对了
+    if(mycpu()->noff != 0)
+        panic("task_yield: interrupts disabled by push_off");
+    irqoff_begin();
+    switch_yield();
 }
 
-/* 延时函数,很低级的实现,后续可能会改 */
+/*
+ * 在trap中请求重新调度,例如系统调用中睡眠
+ * trap_vector已经保存了全部寄存器,但此时mepc还没有调整好,不能直接schedule
+ * 所以生成软中断,等trap返回、中断打开后再进入schedule
+ */
+void task_resched()
+{
+    // 关中断后再读取hart id,防止读取之后被切换到别的hart上
+    push_off();
+    *((uint32_t*)CLIENT_MSIP(r_mhartid())) = 1;
+    pop_off();
+}
+
+#ifdef CONFIG_BENCH
+#define SCHED_BENCH_LOOPS 1000
+/*
+ * 任务切换的测试,作为优先级最高的任务反复让出hart,统计切换SCHED_BENCH_LOOPS次花费的CLINT时钟数
+ * yield: task_yield只保存被调用者保存的寄存器
+ * trap: 通过软中断进入trap_vector保存全部寄存器,和定时器抢占的路径相同
+ * via kernel task: 通过软中断进入trap后先回到内核任务,由内核任务再调度,多一次switch_to和一次上下文保存
+ * 每次让出之前把自己的优先级改回0,保证选出来的下一个任务还是自己,其他任务不会混进统计里
+ */
+void sched_bench(void *param)
+{
+    static char *modes[] = {"yield", "trap", "via kernel task"};
+    printf("\n\n==============> sched_bench <==============\n\n");
+    for(int mode = 0; mode < 3; ++mode)
+    {
+        uint64_t start = timer_mtime();
+        for(int i = 0; i < SCHED_BENCH_LOOPS; ++i)
+        {
+            // 正在运行的任务不在就绪队列中,可以直接修改优先级
+            push_off();
+            mycpu()->cur_task->priority = 0;
+            _bench_bounce[r_mhartid()] = mode == 2;
+            if(mode != 0)
+                task_resched();
+            pop_off();
+            if(mode == 0)
+                task_yield();
+        }
+        uint64_t cycles = timer_mtime() - start;
+        printf("%s: %d cycles per %d switches\n", modes[mode], (int)cycles, SCHED_BENCH_LOOPS);
+    }
+    printf("\n\n==============> END sched_bench <==============\n\n");
+    task_exit();
+}
+#endif
+
+/* 修改当前任务的状态并返回当前任务,需要在push_off之后调用 */
+static struct taskInfo *_task_set_state(enum taskState state)
+{
+    struct taskInfo *task = mycpu()->cur_task;
+    struct rq *rq = &_rqs[r_mhartid()];
+    spin_lock(&rq->lock);
+    task->state = state;
+    spin_unlock(&rq->lock);
+    return task;
+}
+
+/*
+ * 把当前任务设置为睡眠状态并返回,需要在push_off之后调用
+ * 正在运行的任务不在就绪队列中,切换下来时schedule看到是睡眠状态就不会放回,到时间后由定时器调用task_wakeup放回
+ */
+static struct taskInfo *_task_set_sleeping()
+{
+    return _task_set_state(SLEEPING);
+}
+
+/*
+ * 把当前任务设置为阻塞状态,之后调用task_yield就会切换走,直到被task_wakeup唤醒
+ * 要先设置阻塞状态再检查等待的条件,条件已经满足就调用task_set_running,不满足才task_yield,
+ * 这样在检查条件和task_yield之间到来的唤醒不会丢失
+ */
+void task_set_blocked()
+{
+    push_off();
+    _task_set_state(BLOCKED);
+    pop_off();
+}
+
+void task_set_running()
+{
+    push_off();
+    _task_set_state(RUNNING);
+    pop_off();
+}
+
+/*
+ * 延时函数,很低级的实现,后续可能会改
+ * task_sleep只把当前任务设置为睡眠状态并放入睡眠队列,不切换,系统调用中用它再加上task_resched
+ */
 #ifdef RV32
+void task_sleep(uint32_t tick)
+{
+    // 关中断,防止读取hart id之后被调度到别的hart
+    push_off();
+    timer_sleep(_task_set_sleeping(), tick);
+    pop_off();
+}
+
 void task_delay(uint32_t tick)
 {
-    cur_task->state = SLEEPING;
-    timer_create(NULL, NULL, tick);
+    // task_sleep之后、切换之前被定时器抢占也没关系,schedule看到是睡眠状态不会放回就绪队列,
+    // 如果已经被唤醒了,这里的task_yield只是多调度一次
+    task_sleep(tick);
     task_yield();
 }
 #else
+void task_sleep(uint64_t tick)
+{
+    // 关中断,防止读取hart id之后被调度到别的hart
+    push_off();
+    timer_sleep(_task_set_sleeping(), tick);
+    pop_off();
+}
+
 void task_delay(uint64_t tick)
 {
-    cur_task->state = SLEEPING;
-    timer_create(NULL, NULL, tick);
+    // task_sleep之后、切换之前被定时器抢占也没关系,schedule看到是睡眠状态不会放回就绪队列,
+    // 如果已经被唤醒了,这里的task_yield只是多调度一次
+    task_sleep(tick);
     task_yield();
 }
 #endif
 
+/* 以纳秒为单位的睡眠,不受tick的限制,由hart 0的mtimecmp直接设置为唤醒时间 */
+void task_sleep_ns(uint64_t ns)
+{
+    push_off();
+    timer_sleep_ns(_task_set_sleeping(), ns);
+    pop_off();
+}
+
+void task_delay_ns(uint64_t ns)
+{
+    task_sleep_ns(ns);
+    task_yield();
+}
+
 /* 退出任务 */
 void task_exit()
 {
-    if(cur_task == NULL)
-        return;
-    if(cur_task->task_id == first_task->task_id) 
-    {
-        first_task = first_task->next;
-    }
-    else
+    push_off();
+    struct taskInfo *task = mycpu()->cur_task;
+    if(task == NULL)
     {
-        // 查找cur_task的前后,是的前后的节点越过cur_task直接相连
-        struct taskInfo *it = first_task;
-        struct taskInfo *prev = first_task;
-        while(it && it->task_id != cur_task->task_id)
-        {
-            prev = it;
-            it = it->next;
-        }
-        prev->next = cur_task->next;
+        pop_off();
+        return;
     }
-    free((void *)cur_task);
-    --_tasks_num;
-    // 这里按照之前非抢占式情况会将当前正在执行的要被退出的任务保存上下文
-    // 但是抢占式之后switch_to函数没有保存指令了,所以就不会保存了,不需要设置mscratch为0了
-    task_yield(); // 不知道为啥直接调用schedule函数会出现异常
+    // 此时还运行在自己的栈上,切换时switch_yield也还要把上下文保存到task->ctx中
+    // 所以栈和taskInfo都不能在这里释放,等schedule在trap栈上时再回收
+    struct rq *rq = &_rqs[r_mhartid()];
+    spin_lock(&rq->lock);
+    task->state = EXITED;
+    spin_unlock(&rq->lock);
+    pop_off();
+    // 在这之前被定时器抢占也一样,schedule看到是退出状态就会回收,不会再回来
+    task_yield();
+    panic("After task_exit: never be here");
 }
 
 /* 返回内核任务 */
@@ -177,69 +679,121 @@ void back_os()
 {
     // 写入mstatus的mpp位为machine模式,是的内核代码运行在machine模式
     w_mstatus(r_mstatus() | 3 << 11);
-    switch_to(&(os_task.ctx));
+    // 内核任务没有时间片
+    timer_slice_start(NULL);
+    irqoff_end();
+    switch_to(&(mycpu()->os_task.ctx));
 }
 
 /* 
  * 任务创建函数
- * 参数为待执行任务的第一条指令的地址,所带的参数,任务优先级
+ * 参数为待执行任务的第一条指令的地址,所带的参数,任务优先级,时间片和栈大小
+ * 栈大小为0时使用默认的TASK_STACK_SIZE
  */
 #ifdef RV32
-int task_create(task_func task, void *param, int priority, uint32_t timeslice)
+int task_create(task_func task, void *param, int priority, uint32_t timeslice, size_t stack_size)
 {
-    if(_tasks_num >= MAX_TASK_NUM)
-        return -1;
     /* 
      * 将任务的信息填写到结构体中
      * 第任务执行只需要ra指向下一条指令的地址,sp指向对应的栈即可
      * 必须要有栈是因为任务不可能很简单,以后会需要调用函数之类的,需要栈来实现
     */
     // 开辟任务的结构体
-    struct taskInfo *new_task = (struct taskInfo *)malloc(sizeof(struct taskInfo));
-    new_task->task_id = _task_id++;
+    struct taskInfo *new_task = (struct taskInfo *)kmem_cache_alloc(_task_cache);
+    if(new_task == NULL)
+        return -1;
     new_task->priority = priority;
     new_task->timeslice = timeslice;
-    new_task->next = NULL;
-    new_task->ctx.sp = (reg_t)(&(task_stack[_tasks_num][STACK_SIZE - 1]));
-    new_task->ctx.pc = (reg_t)task; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
-    if(param != NULL)
-        new_task->ctx.a0 = (reg_t)param;
-    // 插入新任务到任务链表中
-    if(insert_task(new_task) < 0)
+    new_task->state = RUNNABLE;
+    new_task->on_cpu = 0;
+    new_task->runtime = 0;
+    new_task->slice_used = 0;
+    new_task->wait_next = NULL;
+    new_task->wait_on = NULL;
+    // 开辟任务栈,大小按16字节向上取整,保证栈顶16字节对齐
+    if(stack_size == 0)
+        stack_size = TASK_STACK_SIZE;
+    new_task->stack_size = (stack_size + 15) & ~(size_t)15;
+    spin_lock(&_sched_lock);
+    new_task->stack = _stack_alloc(new_task->stack_size);
+    spin_unlock(&_sched_lock);
+    if(new_task->stack == NULL)
     {
-        printf("插入任务失败\n");
-        free((void *)new_task);
+        kmem_cache_free(_task_cache, (void *)new_task);
         return -1;
     }
+    _stack_set_canary(new_task->stack);
+    // 对象可能是之前释放的任务,需要把上下文清零,不能带着旧任务的寄存器值
+    memset(&new_task->ctx, 0, sizeof(struct context));
+    new_task->ctx.sp = (reg_t)(new_task->stack + new_task->stack_size);
+    new_task->ctx.pc = (reg_t)task; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
+    if(param != NULL)
+        new_task->ctx.a0 = (reg_t)param;
+    spin_lock(&_sched_lock);
+    new_task->task_id = _task_id++;
+    spin_unlock(&_sched_lock);
+    // 插入新任务到当前hart的就绪队列中,其他空闲的hart会来偷
+    push_off();
+    new_task->cpu = r_mhartid();
+    struct rq *rq = &_rqs[new_task->cpu];
+    spin_lock(&rq->lock);
+    insert_task(rq, new_task);
+    spin_unlock(&rq->lock);
+    _kick_idle(new_task->cpu);
+    pop_off();
     return 0;
 }
 #else
-int task_create(task_func task, void *param, int priority, uint64_t timeslice)
+int task_create(task_func task, void *param, int priority, uint64_t timeslice, size_t stack_size)
 {
-    if(_tasks_num >= MAX_TASK_NUM)
-        return -1;
     /* 
      * 将任务的信息填写到结构体中
      * 第任务执行只需要ra指向下一条指令的地址,sp指向对应的栈即可
      * 必须要有栈是因为任务不可能很简单,以后会需要调用函数之类的,需要栈来实现
     */
     // 开辟任务的结构体
-    struct taskInfo *new_task = (struct taskInfo *)malloc(sizeof(struct taskInfo));
-    new_task->task_id = _task_id++;
+    struct taskInfo *new_task = (struct taskInfo *)kmem_cache_alloc(_task_cache);
+    if(new_task == NULL)
+        return -1;
     new_task->priority = priority;
     new_task->timeslice = timeslice;
-    new_task->next = NULL;
-    new_task->ctx.sp = (reg_t)(&(task_stack[_tasks_num][STACK_SIZE - 1]));
-    new_task->ctx.pc = (reg_t)task; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
-    if(param != NULL)
-        new_task->ctx.a0 = (reg_t)param;
-    // 插入新任务到任务链表中
-    if(insert_task(new_task) < 0)
+    new_task->state = RUNNABLE;
+    new_task->on_cpu = 0;
+    new_task->runtime = 0;
+    new_task->slice_used = 0;
+    new_task->wait_next = NULL;
+    new_task->wait_on = NULL;
+    // 开辟任务栈,大小按16字节向上取整,保证栈顶16字节对齐
+    if(stack_size == 0)
+        stack_size = TASK_STACK_SIZE;
+    new_task->stack_size = (stack_size + 15) & ~(size_t)15;
+    spin_lock(&_sched_lock);
+    new_task->stack = _stack_alloc(new_task->stack_size);
+    spin_unlock(&_sched_lock);
+    if(new_task->stack == NULL)
     {
-        printf("插入任务失败\n");
-        free((void *)new_task);
+        kmem_cache_free(_task_cache, (void *)new_task);
         return -1;
     }
+    _stack_set_canary(new_task->stack);
+    // 对象可能是之前释放的任务,需要把上下文清零,不能带着旧任务的寄存器值
+    memset(&new_task->ctx, 0, sizeof(struct context));
+    new_task->ctx.sp = (reg_t)(new_task->stack + new_task->stack_size);
+    new_task->ctx.pc = (reg_t)task; // 由于switch_to函数不用ret而是用mret,所以这里得需要改成pc
+    if(param != NULL)
+        new_task->ctx.a0 = (reg_t)param;
+    spin_lock(&_sched_lock);
+    new_task->task_id = _task_id++;
+    spin_unlock(&_sched_lock);
+    // 插入新任务到当前hart的就绪队列中,其他空闲的hart会来偷
+    push_off();
+    new_task->cpu = r_mhartid();
+    struct rq *rq = &_rqs[new_task->cpu];
+    spin_lock(&rq->lock);
+    insert_task(rq, new_task);
+    spin_unlock(&rq->lock);
+    _kick_idle(new_task->cpu);
+    pop_off();
     return 0;
 }
 #endif
\ No newline at end of file
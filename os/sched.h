@@ -2,8 +2,14 @@
 #define __SCHED_H__
 
 #include "type.h"
+#include "platform.h"
+#include "riscv.h"
 
-/* 上下文切换的结构体,用于保存各个寄存器 */
+/*
+ * 上下文切换的结构体,用于保存各个寄存器
+ * 被中断抢占时由trap_vector保存全部寄存器,主动让出时由switch_yield只保存ra、sp、s0-s11,pc设置为ra
+ * 两种情况都由switch_to恢复,后者恢复出来的临时寄存器和参数寄存器是旧值,但调用方本来就不会再使用它们
+ */
 struct context {
     /* ignore x0 */
 	reg_t ra;
@@ -42,8 +48,10 @@ struct context {
 	reg_t pc;
 };
 
-/* 任务状态 */
-enum taskState { RUNNING = 0, RUNNABLE, SLEEPING };
+/* 任务状态,SLEEPING为定时睡眠,BLOCKED为等待某个事件,由task_wakeup唤醒 */
+enum taskState { RUNNING = 0, RUNNABLE, SLEEPING, BLOCKED, EXITED };
+
+struct wait_queue;
 
 /* 任务的结构体 */
 struct taskInfo {
@@ -51,28 +59,69 @@ struct taskInfo {
     int priority; // 任务优先级
 	enum taskState state; // 任务状态
 	uint32_t timeslice; // 任务在操作系统调度后能够运行的最长时间
-    struct taskInfo *next; // 后一个任务的指针
+    struct taskInfo *next; // 就绪队列中后一个任务的指针
+    struct taskInfo *prev; // 就绪队列中前一个任务的指针
+    int on_cpu; // 是否正在某个hart上运行,切换下来并保存好上下文之后才清零
+    int cpu; // 任务所在的就绪队列对应的hart,或者正在运行/最后一次运行的hart
+    struct taskInfo *sleep_next; // 睡眠队列中后一个任务的指针
+    uint64_t wake_time; // 睡眠的任务被唤醒的mtime
+    struct taskInfo *wait_next; // 等待队列中后一个任务的指针
+    struct wait_queue *wait_on; // 所在的等待队列,不在等待队列中为NULL
+    reg_t futex_key; // FUTEX_WAIT等待的用户地址
+    uint64_t switch_in; // 最近一次切换进来运行时的mtime
+    uint64_t runtime; // 累计运行的CLINT时钟数
+    uint64_t slice_used; // 当前时间片已经用掉的CLINT时钟数,主动让出时保留,用完才清零
+    uint8_t *stack; // 任务栈的最低地址,栈底的几个字用于溢出检测
+    uint32_t stack_size; // 任务栈的字节数
     struct context ctx; // 任务的上下文结构体的指针
 };
 
+/* 优先级个数,优先级为0到MAX_PRIORITY - 1,数值越小优先级越高 */
+#define MAX_PRIORITY 256
+
 /* 任务的类型 */
 typedef void (*task_func)(void *param);
 
-/* 定义任务最大个数 */
-#define MAX_TASK_NUM 10
-
 /* entry.S中定义的函数 */
 extern void switch_to(struct context *next);
+extern void switch_yield(void);
 
-/* 任务栈大小 */
+/* 每个hart的内核任务的栈大小 */
 #define STACK_SIZE 1024
-/* 内核栈 */
-uint8_t os_stack[STACK_SIZE];
-/* 内核taskInfo */
-struct taskInfo os_task;
-/* 任务栈,由于任务个数最多10个,所以就申请10个栈 */
-uint8_t task_stack[MAX_TASK_NUM][STACK_SIZE];
-/* 任务要保存的寄存器的结构体变量 */
-// struct context task_ctx[MAX_TASK_NUM];
+
+/* 每个hart自己的调度状态 */
+struct cpu
+{
+    struct taskInfo *cur_task; // 当前hart上正在运行的任务,运行内核任务时为NULL
+    struct taskInfo os_task; // 当前hart的内核任务
+    int noff; // push_off的嵌套深度
+    int intena; // 最外层push_off之前中断是否打开
+    int started; // 是否已经完成初始化并参与调度
+    uint32_t steals; // 从其他hart偷来的任务数
+    uint32_t migrations; // 从其他hart迁移到本hart运行的任务数
+    uint64_t start_time; // 开始参与调度时的mtime
+    uint64_t idle_time; // 在cpu_idle中wfi的CLINT时钟数,其余时间都算作忙碌
+    uint64_t irqoff_start; // 本次关中断开始的mtime,为0表示没有在统计
+    uint64_t irqoff_max; // 开启CONFIG_IRQSTAT时统计的最长关中断时间
+};
+
+extern struct cpu cpus[MAXNUM_CPU];
+
+/* 当前hart的调度状态,需要在关中断时使用,否则读取之后可能被切换到别的hart上 */
+static inline struct cpu *mycpu()
+{
+    return &cpus[r_mhartid()];
+}
+
+/*
+ * 任务栈的默认大小,task_create时stack_size为0就使用该值
+ * trap处理在每个hart的trap栈上执行,任务栈只需要满足任务自己的代码,不需要再给内核路径预留空间
+ * 任务栈用malloc开辟,不超过1024字节时从slab分配,一页可以放多个任务栈
+ */
+#define TASK_STACK_SIZE 1024
+
+/* 栈底填充的用于检测栈溢出的字的个数和值,任务切换时检查,被改写说明栈溢出了 */
+#define STACK_CANARY_WORDS 4
+#define STACK_CANARY ((reg_t)0x5a5a5a5a5a5a5a5aULL)
 
 #endif
\ No newline at end of file
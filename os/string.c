@@ -0,0 +1,132 @@
+#include "os.h"
+
+/*
+ * 内存拷贝和填充函数
+ * 先按字节处理到字对齐,然后按字(RV64为8字节,RV32为4字节)处理,每次循环处理4个字,最后按字节处理剩下的部分
+ * 开启RVV后使用string_rvv.S中的向量版本
+ */
+#ifndef CONFIG_RVV
+
+#define WORD_SIZE sizeof(reg_t)
+#define WORD_MASK (WORD_SIZE - 1)
+
+void *memset(void *dest, int c, size_t n)
+{
+    uint8_t *d = (uint8_t *)dest;
+    // 按字节填充到字对齐
+    while(n && ((reg_t)d & WORD_MASK))
+    {
+        *d++ = (uint8_t)c;
+        --n;
+    }
+    if(n >= WORD_SIZE)
+    {
+        // 将c复制到字的每个字节
+        reg_t w = (uint8_t)c;
+        w |= w << 8;
+        w |= w << 16;
+#ifndef RV32
+        w |= w << 32;
+#endif
+        reg_t *wd = (reg_t *)d;
+        for(; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wd += 4)
+        {
+            wd[0] = w;
+            wd[1] = w;
+            wd[2] = w;
+            wd[3] = w;
+        }
+        for(; n >= WORD_SIZE; n -= WORD_SIZE)
+            *wd++ = w;
+        d = (uint8_t *)wd;
+    }
+    while(n--)
+        *d++ = (uint8_t)c;
+    return dest;
+}
+
+/*
+ * 从前往后拷贝
+ * 只有dest和src字内偏移相同时才能同时对齐,否则按字访问就是非对齐访问,在RISC-V上可能触发异常或者很慢,所以只能按字节拷贝
+ * dest在src前面时从前往后拷贝,即使有重叠,写入的位置也都是已经读过的,所以memmove也可以用
+ */
+static void *_memcpy_forward(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+    if((((reg_t)d ^ (reg_t)s) & WORD_MASK) == 0)
+    {
+        while(n && ((reg_t)d & WORD_MASK))
+        {
+            *d++ = *s++;
+            --n;
+        }
+        reg_t *wd = (reg_t *)d;
+        const reg_t *ws = (const reg_t *)s;
+        for(; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wd += 4, ws += 4)
+        {
+            wd[0] = ws[0];
+            wd[1] = ws[1];
+            wd[2] = ws[2];
+            wd[3] = ws[3];
+        }
+        for(; n >= WORD_SIZE; n -= WORD_SIZE)
+            *wd++ = *ws++;
+        d = (uint8_t *)wd;
+        s = (const uint8_t *)ws;
+    }
+    while(n--)
+        *d++ = *s++;
+    return dest;
+}
+
+/* 从后往前拷贝,用于dest在src后面且有重叠的情况 */
+static void *_memcpy_backward(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dest + n;
+    const uint8_t *s = (const uint8_t *)src + n;
+    if((((reg_t)d ^ (reg_t)s) & WORD_MASK) == 0)
+    {
+        while(n && ((reg_t)d & WORD_MASK))
+        {
+            *--d = *--s;
+            --n;
+        }
+        reg_t *wd = (reg_t *)d;
+        const reg_t *ws = (const reg_t *)s;
+        for(; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE)
+        {
+            wd -= 4;
+            ws -= 4;
+            wd[3] = ws[3];
+            wd[2] = ws[2];
+            wd[1] = ws[1];
+            wd[0] = ws[0];
+        }
+        for(; n >= WORD_SIZE; n -= WORD_SIZE)
+            *--wd = *--ws;
+        d = (uint8_t *)wd;
+        s = (const uint8_t *)ws;
+    }
+    while(n--)
+        *--d = *--s;
+    return dest;
+}
+
+void *memcpy(void *dest, const void *src, size_t n)
+{
+    return _memcpy_forward(dest, src, n);
+}
+
+/* 允许dest和src有重叠 */
+void *memmove(void *dest, const void *src, size_t n)
+{
+    if(dest == src || n == 0)
+        return dest;
+    // dest在src前面,或者两者没有重叠,就从前往后拷贝
+    if((reg_t)dest < (reg_t)src || (reg_t)dest >= (reg_t)src + n)
+        return _memcpy_forward(dest, src, n);
+    return _memcpy_backward(dest, src, n);
+}
+
+#endif
@@ -16,9 +16,51 @@ void do_syscall(struct context *ctx)
     switch (call_num)
     {
     case SYS_sleep:
-        task_delay(ctx->a0);
+        // 在trap中不能用task_yield,等trap返回后由软中断切换
+        task_sleep(ctx->a0);
+        task_resched();
         ctx->a0 = 0;
         break;
+    case SYS_sleep_ns:
+    {
+        // RV32下64位的参数由a0(低32位)和a1(高32位)两个寄存器传递
+#ifdef RV32
+        uint64_t ns = ((uint64_t)ctx->a1 << 32) | ctx->a0;
+#else
+        uint64_t ns = ctx->a0;
+#endif
+        task_sleep_ns(ns);
+        task_resched();
+        ctx->a0 = 0;
+        break;
+    }
+    case SYS_futex:
+        if(ctx->a1 == FUTEX_WAIT)
+        {
+            // 值已经变了就直接返回,让用户重新检查
+            if(futex_wait((volatile uint32_t *)ctx->a0, ctx->a2) != 0)
+            {
+                ctx->a0 = -1;
+                break;
+            }
+            // 已经在持锁时放入等待队列并设置为阻塞状态,不能等软中断来调度,那样会被当作被抢占而放回就绪队列
+            // 所以跳过ecall之后直接主动切换,被FUTEX_WAKE唤醒后从ecall的下一条指令继续执行
+            ctx->a0 = 0;
+            ctx->pc += 4;
+            schedule_yield();
+        }
+        else if(ctx->a1 == FUTEX_WAKE)
+        {
+            ctx->a0 = futex_wake((volatile uint32_t *)ctx->a0, ctx->a2);
+        }
+        else
+        {
+            ctx->a0 = -1;
+        }
+        break;
+    case SYS_heap_stats:
+        ctx->a0 = heap_get_stats((struct heap_stats *)ctx->a0);
+        break;
     default:
         printf("Unknown syscall no: %d\n", call_num);
         ctx->a0 = -1;
@@ -2,5 +2,12 @@
 #define __SYSCALL_H__
 
 #define SYS_sleep 1
+#define SYS_heap_stats 2
+#define SYS_sleep_ns 3
+#define SYS_futex 4
+
+/* futex的操作 */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
 
 #endif
\ No newline at end of file
@@ -1,21 +1,87 @@
 #include "os.h"
 
-/* 由于CLINT时钟 每秒10000000 ticks,那么经过这些ticks就过了一秒钟 */
-#define TIMER_INTERVAL CLINT_TIMEBASE_FREQ
+/* CLINT时钟每个周期的纳秒数,QEMU virt为100ns */
+#define NSEC_PER_CYCLE (1000000000 / CLINT_TIMEBASE_FREQ)
 
-/* 软件定时器头部指针 */
-struct timer *first_timer = NULL;
+/*
+ * 软件定时器的分层时间轮,和Linux早期的timer wheel一样
+ * 第一层tv1有256个槽,每个槽对应一个tick,放256个tick以内到期的定时器
+ * 后面tvn的4层每层64个槽,第n层每个槽对应2^(8+6n)个tick,放更晚到期的定时器
+ * 插入时根据到期时间和_timer_jiffies的差值选择层和槽,删除时通过pprev直接摘下,都是O(1)
+ * tv1转完一圈时把tvn[0]的下一个槽中的定时器重新插入(cascade),这时它们都会落到tv1中,高层依次类推
+ * 32位的tick差值最多需要4层tvn,RV64下更晚到期的定时器放在最后一层,转到时再重新插入
+ */
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_NUM 4
+/* tvn第n层当前tick对应的槽 */
+#define TVN_INDEX(j, n) (((j) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+static struct timer *_tv1[TVR_SIZE];
+static struct timer *_tvn[TVN_NUM][TVN_SIZE];
+/* 时间轮已经处理到的tick,比它小的tick上的定时器都已经执行过了,和_ticks一样RV32为32位,RV64为64位 */
+static reg_t _timer_jiffies = 0;
+
+/*
+ * 睡眠队列,按唤醒的mtime从小到大排序,由_timer_lock保护
+ * 睡眠的任务不在就绪队列中,也不占用软件定时器,到期时由hart 0一次性全部唤醒
+ */
+static struct taskInfo *_sleep_queue = NULL;
+
+/*
+ * 高精度定时器链表,按到期的mtime从小到大排序,由_timer_lock保护
+ * 不经过tick,hart 0的mtimecmp直接设置为最早的到期时间,适合微秒级的短定时,长时间的定时用时间轮
+ */
+static struct timer *_hres_timers = NULL;
+
+/*
+ * 已经到期、等待执行回调的定时器,按到期的先后顺序链接,由_timer_lock保护
+ * 定时器中断中只把到期的定时器从时间轮和高精度定时器链表移到这里,回调由_timer_thread在开中断时执行
+ * 同样通过next和pprev链接,所以还没执行的定时器也可以直接timer_delete
+ */
+static struct timer *_expired = NULL;
+static struct timer **_expired_tail = &_expired;
 
+/* 执行定时器回调的内核线程,开始运行后才会被定时器中断唤醒 */
+static struct taskInfo *_timer_task = NULL;
+
+/* 软件定时器的对象缓存,定时器创建和删除比较频繁,所以不走malloc */
+static struct kmem_cache *_timer_cache = NULL;
+
+/* 保护软件定时器链表,所有hart都可以创建和删除定时器 */
+static struct spinlock _timer_lock;
+
+/* _ticks只由hart 0在定时器中断中增加 */
 #ifdef RV32
 static uint32_t _ticks = 0;
-static uint32_t _cur_task_start_tick = 0;
 #else
 static uint64_t _ticks = 0;
-static uint64_t _cur_task_start_tick = 0;
 #endif
+/* 上一次打印的系统运行秒数,HZ大于1时每秒只打印一次 */
+#ifdef RV32
+static uint32_t _printed_seconds = 0;
+#else
+static uint64_t _printed_seconds = 0;
+#endif
+/*
+ * 下一个tick到来时的mtime,hart 0按这个绝对时间设置mtimecmp,所以tick不会因为中断处理的延迟而漂移
+ * hart 0空闲时会跳过中间的tick,_ticks由_tick_update根据mtime补上
+ */
+static uint64_t _next_tick_mtime = 0;
 
-// sched.c中的当前任务
-extern struct taskInfo *cur_task;
+/* 每个hart当前任务时间片结束的mtime,运行内核任务时为-1,只由hart自己在关中断时访问 */
+static uint64_t _slice_end[MAXNUM_CPU];
+
+/*
+ * hart 0的mtimecmp当前的值和hart 0是否空闲,由_timer_lock保护
+ * 其他hart加入了更早到期的定时器或睡眠任务时直接把hart 0的mtimecmp改小,不需要发送软中断
+ */
+static uint64_t _hart0_cmp = (uint64_t)-1;
+static int _hart0_idle = 0;
 
 /* 
  * mtime寄存器是实时计数器,上电后硬件复位为0并开始记录tick,表示系统运行了多少个tick,即多少时间,这个寄存器仅此一个,所有hart共享
@@ -24,49 +90,323 @@ extern struct taskInfo *cur_task;
  *   1.必须mstatus的全局总中断开启(这里采用machine模式)
  *   2.还需要mie中的MIE_MTIE(machine模式的定时器中断)开启
  * 当timer中断发生时,hart会设置mip.mtip(即当前machine模式下的timer中断正在发生),程序可以在mtimecmp中写入新值以清除mip.mtip
+ * 每次中断后都把mtimecmp重新设置为下一个最早的截止时间(时间片结束、tick、定时器到期或者任务唤醒),而不是固定的间隔
  */
 
 /* 使mtimecmp寄存器加载ticks */
 void timer_load(int interval)
 {
-    reg_t hart_id = r_tp();
+    reg_t hart_id = r_mhartid();
     // MTIMECMP应该是当前时间+interval间隔
     *((uint64_t*)CLIENT_MTIMECMP(hart_id)) = *((uint64_t*)CLIENT_MTIME) + interval;
 }
 
-/* 软件和硬件定时器初始化函数 */
-void timer_init()
+/*
+ * 设置hart的mtimecmp为绝对时间
+ * RV32下要分两次写,先把低32位写成最大值,防止写完高32位时新旧两半拼出一个更小的值而产生多余的中断
+ */
+static void _timer_set(int hart, uint64_t mtime)
+{
+#ifdef RV32
+    volatile uint32_t *cmp = (volatile uint32_t*)CLIENT_MTIMECMP(hart);
+    cmp[0] = 0xffffffff;
+    cmp[1] = (uint32_t)(mtime >> 32);
+    cmp[0] = (uint32_t)mtime;
+#else
+    *((volatile uint64_t*)CLIENT_MTIMECMP(hart)) = mtime;
+#endif
+}
+
+/* 读取mtime寄存器,即开机到现在经过的CLINT时钟数 */
+uint64_t timer_mtime()
+{
+#ifdef RV32
+    // 32位下需要分两次读取,如果读取期间低32位进位了,高32位会变化,需要重新读取
+    uint32_t hi, lo;
+    do
+    {
+        hi = *((volatile uint32_t*)(CLIENT_MTIME + 4));
+        lo = *((volatile uint32_t*)CLIENT_MTIME);
+    } while(hi != *((volatile uint32_t*)(CLIENT_MTIME + 4)));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return *((volatile uint64_t*)CLIENT_MTIME);
+#endif
+}
+
+
+/*
+ * 64位数除以32位数
+ * RV32下-nostdlib没有libgcc的__udivdi3,先用32位除法算出高32位的商,再逐位算低32位的商
+ */
+static uint64_t _div_u64(uint64_t n, uint32_t d)
+{
+#ifdef RV32
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t qhi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t qlo = 0;
+    for(int i = 31; i >= 0; --i)
+    {
+        // r < d,左移一位后可能超过32位,最高位移出时一定大于d
+        uint32_t top = r >> 31;
+        r = (r << 1) | ((lo >> i) & 1);
+        if(top || r >= d)
+        {
+            r -= d;
+            qlo |= (uint32_t)1 << i;
+        }
+    }
+    return ((uint64_t)qhi << 32) | qlo;
+#else
+    return n / d;
+#endif
+}
+
+/* 纳秒转换为CLINT时钟数,向上取整,保证至少等待ns纳秒 */
+uint64_t timer_ns_to_mtime(uint64_t ns)
+{
+    return _div_u64(ns + NSEC_PER_CYCLE - 1, NSEC_PER_CYCLE);
+}
+
+/* CLINT时钟数转换为微秒 */
+uint64_t timer_mtime_to_us(uint64_t mtime)
+{
+    return _div_u64(mtime, CLINT_TIMEBASE_FREQ / 1000000);
+}
+
+/* CLINT时钟数转换为纳秒 */
+uint64_t timer_mtime_to_ns(uint64_t mtime)
 {
-    // 软件定时器初始化
-    struct timer *it = first_timer;
+    return mtime * NSEC_PER_CYCLE;
+}
+
+/*
+ * 根据mtime补上已经过去的tick,需要持有_timer_lock
+ * 平时每次只会加1,hart 0空闲跳过了tick时一次补上多个
+ */
+static void _tick_update()
+{
+    uint64_t now = timer_mtime();
+    while(now >= _next_tick_mtime)
+    {
+        ++_ticks;
+        _next_tick_mtime += TIMER_INTERVAL;
+    }
+}
+
+/* _ticks到达tick时的mtime,已经到达的返回0,需要持有_timer_lock */
+static uint64_t _tick_to_mtime(reg_t tick)
+{
+    if(tick <= _ticks)
+        return 0;
+    return _next_tick_mtime + (uint64_t)(tick - _ticks - 1) * TIMER_INTERVAL;
+}
+
+/* 加入了deadline到期的定时器或睡眠任务,比hart 0的mtimecmp早就改小,需要持有_timer_lock */
+static void _hart0_update(uint64_t deadline)
+{
+    if(deadline < _hart0_cmp)
+    {
+        _hart0_cmp = deadline;
+        _timer_set(0, deadline);
+    }
+}
+
+/* 将定时器放入时间轮,需要持有_timer_lock */
+static void _timer_add(struct timer *t)
+{
+    reg_t expires = t->timeout;
+    reg_t idx = expires - _timer_jiffies;
+    struct timer **head;
+    if(idx >> (BITS_PER_REG - 1))
+    {
+        // 已经过期了,放到下一个要处理的槽中
+        head = &_tv1[_timer_jiffies & TVR_MASK];
+    }
+    else if(idx < TVR_SIZE)
+    {
+        head = &_tv1[expires & TVR_MASK];
+    }
+    else
+    {
+        int n = 0;
+        while(n < TVN_NUM - 1 && idx >= ((reg_t)1 << (TVR_BITS + (n + 1) * TVN_BITS)))
+            ++n;
+#ifndef RV32
+        // 超出最后一层的范围,先放在最远的槽,转到时cascade会再放一次
+        if(idx > 0xffffffffUL)
+            expires = _timer_jiffies + 0xffffffffUL;
+#endif
+        head = &_tvn[n][TVN_INDEX(expires, n)];
+    }
+    t->next = *head;
+    if(*head)
+        (*head)->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+}
+
+/* 将定时器从时间轮、高精度定时器链表或者到期链表中摘下,需要持有_timer_lock */
+static void _timer_detach(struct timer *t)
+{
+    if(t->pprev == NULL)
+        return;
+    if(_expired_tail == &t->next)
+        _expired_tail = t->pprev;
+    *t->pprev = t->next;
+    if(t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/* 把摘下来的定时器加到到期链表的末尾,需要持有_timer_lock */
+static void _expired_add(struct timer *t)
+{
+    t->next = NULL;
+    t->pprev = _expired_tail;
+    *_expired_tail = t;
+    _expired_tail = &t->next;
+}
+
+/* 把tvn第n层第index个槽中的定时器重新放入时间轮,返回index,为0说明这一层也转完一圈了 */
+static int _timer_cascade(int n, int index)
+{
+    struct timer *it = _tvn[n][index];
+    _tvn[n][index] = NULL;
     while(it)
     {
-        it->func = NULL;
-        it->args = NULL;
-        it = it->next;
+        struct timer *next = it->next;
+        _timer_add(it);
+        it = next;
     }
+    return index;
+}
 
-    // mtimecmp寄存器加载ticks,使得1s后触发中断
-    timer_load(TIMER_INTERVAL);
+/*
+ * 求时间轮中最早需要处理的tick,用于hart 0空闲时设置唤醒时间,没有定时器返回0
+ * tv1中的定时器就在它所在槽的tick到期;高层的只求出它所在槽cascade的tick,比实际到期早,醒来cascade之后再重新计算
+ */
+static int _timer_next(reg_t *next)
+{
+    int found = 0;
+    reg_t j = _timer_jiffies;
+    int index = j & TVR_MASK;
+    // 先找这一圈剩下的槽,越过边界之前不会有cascade
+    for(int k = index; k < TVR_SIZE; ++k)
+    {
+        if(_tv1[k])
+        {
+            *next = j - index + k;
+            return 1;
+        }
+    }
+    // 前面的槽是下一圈的,要和边界上cascade的tick比较
+    for(int k = 0; k < index; ++k)
+    {
+        if(_tv1[k])
+        {
+            *next = j - index + TVR_SIZE + k;
+            found = 1;
+            break;
+        }
+    }
+    for(int n = 0; n < TVN_NUM; ++n)
+    {
+        int shift = TVR_BITS + n * TVN_BITS;
+        // 当前槽中的定时器要等这一层再转一圈
+        for(int k = 1; k <= TVN_SIZE; ++k)
+        {
+            if(_tvn[n][(TVN_INDEX(j, n) + k) & TVN_MASK])
+            {
+                reg_t when = ((j >> shift) + k) << shift;
+                if(!found || when < *next)
+                    *next = when;
+                found = 1;
+                break;
+            }
+        }
+    }
+    return found;
+}
 
-    // 设置全局中断打开,在plic_init中已经开启了,这里不需要再次开启
-    // w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-    // 设置mie寄存器中硬件定时器开启
-    w_mie(r_mie() | MIE_MTIE);
+/*
+ * hart 0下一次需要处理的时间,需要持有_timer_lock
+ * 忙碌时每个tick都要中断,用于更新_ticks和检查时间轮;空闲时跳过tick,直接到时间轮中最早的定时器
+ * 再和最早的高精度定时器、最早唤醒的睡眠任务比较
+ */
+static uint64_t _hart0_next()
+{
+    uint64_t deadline = (uint64_t)-1;
+    if(!_hart0_idle)
+    {
+        deadline = _next_tick_mtime;
+    }
+    else
+    {
+        reg_t next;
+        if(_timer_next(&next))
+            deadline = _tick_to_mtime(next);
+    }
+    if(_hres_timers != NULL && _hres_timers->deadline < deadline)
+        deadline = _hres_timers->deadline;
+    if(_sleep_queue != NULL && _sleep_queue->wake_time < deadline)
+        deadline = _sleep_queue->wake_time;
+    return deadline;
+}
+
+/* 把当前hart的mtimecmp设置为下一个最早的截止时间,需要关中断调用 */
+static void _timer_program()
+{
+    int hart = r_mhartid();
+    uint64_t deadline = _slice_end[hart];
+    if(hart == 0)
+    {
+        spin_lock(&_timer_lock);
+        uint64_t next = _hart0_next();
+        if(next < deadline)
+            deadline = next;
+        _hart0_cmp = deadline;
+        _timer_set(0, deadline);
+        spin_unlock(&_timer_lock);
+    }
+    else
+    {
+        _timer_set(hart, deadline);
+    }
 }
 
-/* 显示系统从开机到现在运行时间 */
+/*
+ * 任务切换时调用,task从switch_in开始运行,task为NULL表示切换到内核任务,不需要时间片
+ * 时间片按mtime计算,上次没用完的只能用剩下的部分,结束时刚好产生定时器中断,不用等到下一个tick
+ */
+void timer_slice_start(struct taskInfo *task)
+{
+    int hart = r_mhartid();
+    if(task == NULL)
+        _slice_end[hart] = (uint64_t)-1;
+    else
+        _slice_end[hart] = task->switch_in + TASK_SLICE_MTIME(task) - task->slice_used;
+    _timer_program();
+}
+
+/* 显示系统从开机到现在运行时间,每秒打印一次 */
 void elapsed_time()
 {
+    if(_ticks / HZ == _printed_seconds)
+        return;
+    _printed_seconds = _ticks / HZ;
 #ifdef RV32
-    uint32_t seconds = _ticks % 60;
-    uint32_t tmp = _ticks / 60;
+    uint32_t seconds = _printed_seconds % 60;
+    uint32_t tmp = _printed_seconds / 60;
     uint32_t minutes = tmp % 60;
     uint32_t hours = tmp / 60;
 #else
-    uint64_t seconds = _ticks % 60;
-    uint64_t tmp = _ticks / 60;
+    uint64_t seconds = _printed_seconds % 60;
+    uint64_t tmp = _printed_seconds / 60;
     uint64_t minutes = tmp % 60;
     uint64_t hours = tmp / 60;
 #endif
@@ -111,137 +451,381 @@ void elapsed_time()
     printf("%s\n", times);
 }
 
-/* 
- * 将定时器插入链表中 
- * 按照超时时间从小到大排序
+/*
+ * 定时器的下半部,以最高优先级运行的内核线程
+ * 定时器中断中只把到期的定时器移到_expired并唤醒它,回调函数和打印系统运行时间都在这里开中断执行,
+ * 所以回调函数的执行时间不会增加关中断的时间,回调函数中也可以创建和删除定时器
  */
-void insert_timer(struct timer *t)
+static void _timer_thread(void *param)
 {
-    if(!first_timer)
-    {
-        first_timer = t;
-        return;
-    }
-    if(t->timeout < first_timer->timeout)
-    {
-        t->next = first_timer;
-        first_timer = t;
-        return;
-    }
-    struct timer *it = first_timer;
-    struct timer *prev = first_timer;
-    while(it && it->timeout <= t->timeout)
+    _timer_task = task_self();
+    while(1)
     {
-        prev = it;
-        it = it->next;
+        // 先设置阻塞状态再检查,检查之后到来的唤醒会把任务放回就绪队列,task_yield不会一直睡下去
+        task_set_blocked();
+        spin_lock(&_timer_lock);
+        int pending = _expired != NULL || _ticks / HZ != _printed_seconds;
+        spin_unlock(&_timer_lock);
+        if(!pending)
+            task_yield();
+        task_set_running();
+
+        elapsed_time();
+        spin_lock(&_timer_lock);
+        while(_expired)
+        {
+            // 先摘下再释放锁执行回调,回调执行期间其他hart可以timer_delete这个定时器
+            struct timer *t = _expired;
+            timer_func func = t->func;
+            void *args = t->args;
+            _timer_detach(t);
+            if(t->period)
+            {
+                t->timeout += t->period;
+                _timer_add(t);
+                _hart0_update(_tick_to_mtime(t->timeout));
+            }
+            spin_unlock(&_timer_lock);
+            func(args);
+            spin_lock(&_timer_lock);
+        }
+        spin_unlock(&_timer_lock);
     }
-    prev->next = t;
-    t->next = it;
 }
 
-/* 软件定时器创建 */
+/* 软件和硬件定时器初始化函数,只由hart 0在sched_init之后调用一次 */
+void timer_init()
+{
+    // 创建软件定时器的对象缓存
+    spin_init(&_timer_lock, "timer");
+    _timer_cache = kmem_cache_create("timer", sizeof(struct timer), NULL);
+    _next_tick_mtime = timer_mtime() + TIMER_INTERVAL;
+    // 执行定时器回调的内核线程,优先级最高,时间片为1个tick
+    if(task_create(_timer_thread, NULL, 0, 1, 0) != 0)
+        panic("timer_init: create timer thread failed");
+
+    timer_init_hart();
+}
+
+/* 每个hart的硬件定时器初始化,每个hart都有自己的mtimecmp */
+void timer_init_hart()
+{
+    // 还没有任务运行,hart 0只需要等下一个tick,其他hart不需要定时器中断
+    _slice_end[r_mhartid()] = (uint64_t)-1;
+    _timer_program();
+
+    // 设置全局中断打开,在plic_init中已经开启了,这里不需要再次开启
+    // w_mstatus(r_mstatus() | MSTATUS_MIE);
+
+    // 设置mie寄存器中硬件定时器开启
+    w_mie(r_mie() | MIE_MTIE);
+}
+
+/*
+ * 软件定时器创建,timeout个tick之后执行func(args)
+ * period不为0时是周期定时器,之后每period个tick再执行一次,直到timer_delete
+ * 一次性的定时器执行之后不会自动释放,仍然需要调用timer_delete
+ */
 #ifdef RV32
-struct timer *timer_create(timer_func func, void *args, uint32_t timeout)
+struct timer *timer_create_periodic(timer_func func, void *args, uint32_t timeout, uint32_t period)
+#else
+struct timer *timer_create_periodic(timer_func func, void *args, uint64_t timeout, uint64_t period)
+#endif
 {
-    struct timer *t = (struct timer *)malloc(sizeof(struct timer));
+    struct timer *t = (struct timer *)kmem_cache_alloc(_timer_cache);
+    if(t == NULL)
+        return NULL;
     t->func = func;
     t->args = args;
-    t->task = cur_task;
-    t->timeout = _ticks + timeout;
     t->next = NULL;
-    insert_timer(t);
+    t->pprev = NULL;
+    t->period = period;
+    spin_lock(&_timer_lock);
+    // hart 0空闲时_ticks不会每个tick都更新,先补上
+    _tick_update();
+    t->timeout = _ticks + timeout;
+    _timer_add(t);
+    // hart 0空闲的话它设置的唤醒时间可能晚于这个定时器
+    _hart0_update(_tick_to_mtime(t->timeout));
+    spin_unlock(&_timer_lock);
     return t;
 }
+
+/* 一次性的软件定时器创建 */
+#ifdef RV32
+struct timer *timer_create(timer_func func, void *args, uint32_t timeout)
 #else
 struct timer *timer_create(timer_func func, void *args, uint64_t timeout)
+#endif
+{
+    return timer_create_periodic(func, args, timeout, 0);
+}
+
+/* 高精度的一次性定时器创建,ns纳秒之后执行func(args),同样需要调用timer_delete释放 */
+struct timer *timer_create_ns(timer_func func, void *args, uint64_t ns)
 {
-    struct timer *t = (struct timer *)malloc(sizeof(struct timer));
+    struct timer *t = (struct timer *)kmem_cache_alloc(_timer_cache);
+    if(t == NULL)
+        return NULL;
     t->func = func;
     t->args = args;
-    t->task = cur_task;
-    t->timeout = _ticks + timeout;
-    t->next = NULL;
-    insert_timer(t);
+    t->period = 0;
+    t->deadline = timer_mtime() + timer_ns_to_mtime(ns);
+    spin_lock(&_timer_lock);
+    struct timer **pp = &_hres_timers;
+    while(*pp && (*pp)->deadline <= t->deadline)
+        pp = &(*pp)->next;
+    t->next = *pp;
+    if(*pp)
+        (*pp)->pprev = &t->next;
+    *pp = t;
+    t->pprev = pp;
+    _hart0_update(t->deadline);
+    spin_unlock(&_timer_lock);
     return t;
 }
-#endif
 
+/* 删除定时器,还没到期的不会再执行,然后释放,时间轮和高精度定时器都一样 */
 void timer_delete(struct timer *t)
 {
-    struct timer *it = first_timer;
-    if(!it || !t)
+    if(t == NULL)
         return;
-    if(t == first_timer)
+    spin_lock(&_timer_lock);
+    _timer_detach(t);
+    spin_unlock(&_timer_lock);
+    kmem_cache_free(_timer_cache, (void*)t);
+}
+
+/* 将任务按唤醒时间插入睡眠队列,需要持有_timer_lock */
+static void _sleep_insert(struct taskInfo *task)
+{
+    // 唤醒时间相同的任务按睡眠的先后顺序排列
+    struct taskInfo **pp = &_sleep_queue;
+    while(*pp && (*pp)->wake_time <= task->wake_time)
+        pp = &(*pp)->sleep_next;
+    task->sleep_next = *pp;
+    *pp = task;
+    _hart0_update(task->wake_time);
+}
+
+/*
+ * 将任务插入睡眠队列,tick个tick之后由hart 0唤醒
+ * 调用方需要先把任务设置为SLEEPING
+ */
+#ifdef RV32
+void timer_sleep(struct taskInfo *task, uint32_t tick)
+#else
+void timer_sleep(struct taskInfo *task, uint64_t tick)
+#endif
+{
+    spin_lock(&_timer_lock);
+    _tick_update();
+    // 和以前一样在tick到来时唤醒
+    task->wake_time = _tick_to_mtime(_ticks + tick);
+    _sleep_insert(task);
+    spin_unlock(&_timer_lock);
+}
+
+/* 将任务插入睡眠队列,ns纳秒之后由hart 0唤醒,调用方需要先把任务设置为SLEEPING */
+void timer_sleep_ns(struct taskInfo *task, uint64_t ns)
+{
+    task->wake_time = timer_mtime() + timer_ns_to_mtime(ns);
+    spin_lock(&_timer_lock);
+    _sleep_insert(task);
+    spin_unlock(&_timer_lock);
+}
+
+/*
+ * 唤醒所有已经到期的睡眠任务,返回唤醒的个数
+ * 睡眠队列是有序的,到期的任务都在队列头部,持锁时只把这一段摘下来,释放_timer_lock之后再逐个放回就绪队列
+ */
+static int _sleep_check(uint64_t now)
+{
+    spin_lock(&_timer_lock);
+    struct taskInfo *head = _sleep_queue;
+    struct taskInfo *tail = NULL;
+    struct taskInfo *it = _sleep_queue;
+    while(it && it->wake_time <= now)
     {
-        first_timer = first_timer->next;
-        free((void*)t);
-        return;
+        tail = it;
+        it = it->sleep_next;
+    }
+    if(tail == NULL)
+    {
+        spin_unlock(&_timer_lock);
+        return 0;
+    }
+    _sleep_queue = it;
+    tail->sleep_next = NULL;
+    spin_unlock(&_timer_lock);
+
+    int n = 0;
+    while(head)
+    {
+        // task_wakeup之后任务可能马上被别的hart运行并再次睡眠,所以要先取出下一个
+        struct taskInfo *task = head;
+        head = head->sleep_next;
+        task->sleep_next = NULL;
+        task_wakeup(task);
+        ++n;
     }
-    struct timer *prev = first_timer;
-    while(it && it != t)
+    return n;
+}
+
+/* tick j是tv1的边界时,cascade会不会取到定时器,需要持有_timer_lock */
+static int _timer_cascade_pending(reg_t j)
+{
+    for(int lvl = 0; lvl < TVN_NUM; ++lvl)
     {
-        prev = it;
-        it = it->next;
+        int index = TVN_INDEX(j, lvl);
+        if(_tvn[lvl][index])
+            return 1;
+        if(index != 0)
+            break;
     }
-    prev->next = it->next;
-    free((void*)t);
+    return 0;
 }
 
-/* 检查定时器函数,用于执行超时函数 */
-struct taskInfo *timer_check()
+/*
+ * 从_timer_jiffies开始找第一个有事可做的tick,最多到last+1,需要持有_timer_lock
+ * 跳过的tick在tv1中的槽是空的,经过的边界也没有需要cascade的定时器,和逐个处理的结果一样
+ * tv1的槽都检查过一遍之后只需要在每个边界检查cascade,空闲很久之后补tick的开销和跳过的tick数无关
+ */
+static reg_t _timer_skip(reg_t last)
 {
-    struct timer *it = first_timer;
-    while(it)
+    reg_t j = _timer_jiffies;
+    int scanned = 0;
+    while(j <= last)
     {
-        if(it->timeout <= _ticks)
+        int index = j & TVR_MASK;
+        if(index == 0 && _timer_cascade_pending(j))
+            break;
+        if(scanned < TVR_SIZE)
         {
-            if(it->task->state == SLEEPING && it->func == NULL)
-            {
-                struct taskInfo *task = it->task;
-                timer_delete(it);
-                return task;
-            }
-            else
-            {
-                it->func(it->args);
-            }
+            if(_tv1[index])
+                break;
+            ++scanned;
+            ++j;
         }
         else
         {
+            j = (j | TVR_MASK) + 1;
+        }
+    }
+    return j;
+}
+
+/*
+ * 检查定时器函数,在定时器中断中把到期的定时器移到_expired,返回到期的个数,回调由_timer_thread执行
+ * hart 0空闲时跳过的tick在这里补上,由_timer_skip跳过没有定时器的tick,只处理有定时器的槽,需要时再cascade
+ * 到期的高精度定时器也在这里处理
+ */
+static int _timer_check(uint64_t now)
+{
+    int n = 0;
+    spin_lock(&_timer_lock);
+    while(_timer_jiffies <= _ticks)
+    {
+        _timer_jiffies = _timer_skip(_ticks);
+        if(_timer_jiffies > _ticks)
             break;
+        int index = _timer_jiffies & TVR_MASK;
+        // tv1转完一圈,从高层取下一批定时器
+        if(index == 0)
+        {
+            for(int lvl = 0; lvl < TVN_NUM; ++lvl)
+            {
+                if(_timer_cascade(lvl, TVN_INDEX(_timer_jiffies, lvl)) != 0)
+                    break;
+            }
         }
-        it = it->next;
+        ++_timer_jiffies;
+        // 整个槽都到期了,周期定时器在回调执行前才重新插入
+        struct timer *it = _tv1[index];
+        _tv1[index] = NULL;
+        while(it)
+        {
+            struct timer *next = it->next;
+            _expired_add(it);
+            ++n;
+            it = next;
+        }
+    }
+    while(_hres_timers && _hres_timers->deadline <= now)
+    {
+        struct timer *t = _hres_timers;
+        _timer_detach(t);
+        _expired_add(t);
+        ++n;
     }
-    return NULL;
+    spin_unlock(&_timer_lock);
+    return n;
 }
 
-/* 硬件定时器中断处理函数 */
+/*
+ * cpu_idle在wfi之前调用,设置当前hart下一次需要被定时器唤醒的时间
+ * hart 0跳过中间的tick,直接设置为最近的定时器到期或者任务唤醒的时间,没有的话就不设置;其他hart空闲时不需要定时器中断
+ * 空闲期间其他hart加入了更早的定时器或睡眠任务时,会直接改小hart 0的mtimecmp
+ */
+void timer_idle_enter()
+{
+    if(r_mhartid() == 0)
+    {
+        spin_lock(&_timer_lock);
+        _hart0_idle = 1;
+        _tick_update();
+        spin_unlock(&_timer_lock);
+    }
+    _timer_program();
+}
+
+/* cpu_idle从wfi醒来后调用,hart 0恢复每个tick的定时器中断 */
+void timer_idle_exit()
+{
+    if(r_mhartid() == 0)
+    {
+        spin_lock(&_timer_lock);
+        _hart0_idle = 0;
+        spin_unlock(&_timer_lock);
+    }
+    _timer_program();
+}
+
+/*
+ * 硬件定时器中断处理函数,每个hart都有自己的定时器中断
+ * 系统时间、软件定时器和睡眠任务只由hart 0处理,每个hart各自检查自己当前任务的时间片
+ * 中断中只更新tick、收集到期的定时器和唤醒睡眠任务,定时器回调和打印时间交给_timer_thread
+ * 需要切换任务时直接在trap中调用schedule选出下一个任务并switch_to过去,
+ * 被中断的任务的上下文已经在trap_vector中保存好了,不需要先回到内核任务再由它产生软中断来调度
+ * 不需要切换时重新设置mtimecmp为下一个最早的截止时间
+ */
 void timer_handler()
 {
-    ++_ticks;
-    elapsed_time();
-    // 执行软件定时器函数
-    struct taskInfo *task = timer_check();
-    if(task != NULL) //说明是任务sleep到时间了,该进入调度队列了
+    reg_t hart_id = r_mhartid();
+    struct cpu *c = mycpu();
+    uint64_t now = timer_mtime();
+    int woken = 0;
+    if(hart_id == 0)
     {
-        task->state = RUNNABLE;
-        cur_task = task;
-        timer_load(TIMER_INTERVAL);
-        back_os(); //重新调度
+        spin_lock(&_timer_lock);
+        _tick_update();
+        // 高精度定时器和任务唤醒产生的中断不一定经过了tick,进入新的一秒才需要打印
+        int print = _ticks / HZ != _printed_seconds;
+        spin_unlock(&_timer_lock);
+        // 有到期的定时器或者需要打印时间就唤醒_timer_thread
+        if((_timer_check(now) > 0 || print) && _timer_task != NULL)
+        {
+            task_wakeup(_timer_task);
+            ++woken;
+        }
+        // 睡眠到时间的任务全部放回就绪队列
+        woken += _sleep_check(now);
+    }
+    // 有任务被唤醒、当前没有任务或者时间片用完了都重新调度,schedule会为下一个任务设置时间片和mtimecmp
+    if(woken > 0 || c->cur_task == NULL || now >= _slice_end[hart_id])
+    {
+        schedule();
         return; // never be here
     }
-    // 否则就是没有睡眠的任务或者睡眠的任务还没到时间
-    // 重新设置mtimecmp寄存器清除mip.mtip,并且等待下一个硬件定时器中断
-    timer_load(TIMER_INTERVAL);
-    //如果所有的任务都是睡眠的或者当前没有任务了,那么走到这里cur_task为空,那么此时就直接back_os即可
-    if(cur_task == NULL)
-        back_os();
-    // 运行时间已经大于等于任务单次调度能够运行的最大时间了
-    // 当前任务在当初选择的时候就已经是优先级最高的任务了,即使选择出来后降低优先级又插回到任务链表中
-    if(_ticks - _cur_task_start_tick >= cur_task->timeslice)
-    {
-        _cur_task_start_tick = _ticks;
-        // 由于back_os之后会选择一个用户任务执行,所以调用back_os应该在最后,这样前面的timer_load等函数才能重新设置定时器
-        back_os();
-    }
-}
\ No newline at end of file
+    _timer_program();
+}
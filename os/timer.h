@@ -3,6 +3,17 @@
 
 #include "type.h"
 
+/* 系统tick的频率,sleep、定时器和时间片都以tick为单位,编译时用-D HZ=100修改,默认每秒一个tick */
+#ifndef HZ
+#define HZ 1
+#endif
+
+/* 每个tick的CLINT时钟数 */
+#define TIMER_INTERVAL (CLINT_TIMEBASE_FREQ / HZ)
+
+/* 任务完整时间片的CLINT时钟数 */
+#define TASK_SLICE_MTIME(task) ((uint64_t)(task)->timeslice * TIMER_INTERVAL)
+
 /* 定时器超时函数类型 */
 typedef void (*timer_func)(void *args);
 
@@ -11,18 +22,16 @@ struct timer
 {
     timer_func func;
     void *args;
-    struct timer *next;
+    struct timer *next; // 时间轮同一个槽中后一个定时器
+    struct timer **pprev; // 指向前一个定时器的next或者槽的头指针,删除时不需要遍历,为NULL表示不在时间轮中
 #ifdef RV32
-    uint32_t timeout; // 以tick计数
+    uint32_t timeout; // 到期的tick
+    uint32_t period; // 周期定时器的周期,为0表示只执行一次
 #else
-    uint64_t timeout; // 以tick计数
+    uint64_t timeout; // 到期的tick
+    uint64_t period; // 周期定时器的周期,为0表示只执行一次
 #endif
-    /* 
-     * 下面是为了task_delay加上的
-     * 当任务处于sleep状态,说明是主动调用task_delay,所以不去执行func
-     * 当任务处于其他状态,需要去执行func
-    */
-    struct taskInfo *task;
+    uint64_t deadline; // 高精度定时器到期的mtime,时间轮中的定时器不使用
 };
 
 #endif
\ No newline at end of file
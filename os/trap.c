@@ -2,6 +2,9 @@
 
 extern void trap_vector(void);
 
+/* 每个hart的trap栈,trap_vector保存完上下文后切换到这里执行trap_handler */
+uint8_t trap_stack[MAXNUM_CPU][TRAP_STACK_SIZE] __attribute__((aligned(16)));
+
 /* trap初始化指的是设置trap处理基址,在这里就是trap处理函数的地址,即设置mtvec寄存器 */
 void trap_init()
 {
@@ -30,14 +33,39 @@ void external_interrupt_handler()
 void software_interrupt_handler()
 {
     // 关闭当前的软中断
-    reg_t hart_id = r_tp();
+    reg_t hart_id = r_mhartid();
     *((uint32_t*)CLIENT_MSIP(hart_id)) = 0;
     // 任务切换
     schedule();
 }
 
+#ifdef CONFIG_IRQSTAT
+/*
+ * 关中断时间统计,trap处理、push_off到pop_off之间以及task_yield切换的过程中中断都是关闭的
+ * 开始时记录mtime,结束时(trap返回、switch_to切换到下一个任务、pop_off恢复中断)更新当前hart的最大值
+ */
+void irqoff_begin()
+{
+    struct cpu *c = mycpu();
+    if(c->irqoff_start == 0)
+        c->irqoff_start = timer_mtime();
+}
+
+void irqoff_end()
+{
+    struct cpu *c = mycpu();
+    if(c->irqoff_start == 0)
+        return;
+    uint64_t d = timer_mtime() - c->irqoff_start;
+    if(d > c->irqoff_max)
+        c->irqoff_max = d;
+    c->irqoff_start = 0;
+}
+#endif
+
 reg_t trap_handler(reg_t epc, reg_t cause, struct context *ctx)
 {
+    irqoff_begin();
     // 这里传递过来的epc为指令地址,如果是异常那就是产生异常的语句,如果是中断那就是产生中断的语句的下一条语句
     reg_t return_epc = epc;
     reg_t cause_code = cause & (~(1 << (MXLEN - 1)));
@@ -83,6 +111,7 @@ reg_t trap_handler(reg_t epc, reg_t cause, struct context *ctx)
         // 然后将return_epc加上一个地址跳过产生异常的指令,由于是32位,加4即可
         // return_epc += 4;
     }
+    irqoff_end();
     return return_epc;
 }
 
@@ -0,0 +1,43 @@
+#include "user_api.h"
+
+/*
+ * 用户态互斥锁,通过futex系统调用只在有竞争时进入内核
+ * 获取: amoswap把值换成1,原来是0就获取成功;否则换成2表示有等待者,换出来的还不是0就FUTEX_WAIT等值不再是2
+ * 释放: amoswap把值换成0,原来是2说明可能有任务在等待,FUTEX_WAKE唤醒一个
+ * 快速路径换成1时可能覆盖掉了2,但之后的慢速路径会重新写成2,所以等待的任务不会丢失唤醒
+ */
+
+/* 原子地把*p换成v并返回旧值,aq保证临界区中的读写不会提前到获取锁之前 */
+static uint32_t _swap_acquire(volatile uint32_t *p, uint32_t v)
+{
+    uint32_t old;
+    asm volatile("amoswap.w.aq %0, %1, (%2)" : "=r"(old) : "r"(v), "r"(p) : "memory");
+    return old;
+}
+
+/* rl保证临界区中的读写在释放之前完成 */
+static uint32_t _swap_release(volatile uint32_t *p, uint32_t v)
+{
+    uint32_t old;
+    asm volatile("amoswap.w.rl %0, %1, (%2)" : "=r"(old) : "r"(v), "r"(p) : "memory");
+    return old;
+}
+
+void ulock_init(ulock_t *lock)
+{
+    lock->val = 0;
+}
+
+void ulock_acquire(ulock_t *lock)
+{
+    if(_swap_acquire(&lock->val, 1) == 0)
+        return;
+    while(_swap_acquire(&lock->val, 2) != 0)
+        futex(&lock->val, FUTEX_WAIT, 2);
+}
+
+void ulock_release(ulock_t *lock)
+{
+    if(_swap_release(&lock->val, 0) == 2)
+        futex(&lock->val, FUTEX_WAKE, 1);
+}
@@ -3,7 +3,7 @@
 
 #define DELAY 1000
 
-lock_t lock;
+ulock_t lock;
 
 /* 软件定时器测试 */
 struct userdata {
@@ -43,6 +43,15 @@ void user_task1(void *param)
     timer_delete(t1);
     timer_delete(t2);
     timer_delete(t3);
+    struct heap_stats stats;
+    if(heap_stats(&stats) == 0)
+        printf("Task 1: heap used %d pages, max used %d pages, largest free run %d pages\n",
+            stats.used_pages, stats.max_used_pages, stats.largest_free_run);
+    sched_print_stats();
+#ifdef CONFIG_LOCKSTAT
+    lockstat_print();
+#endif
+    printf("Task 1: ran %d ns\n", (int)task_runtime_ns());
     printf("Task 1: Deleting...\n");
     task_exit();
 }
@@ -54,9 +63,9 @@ void user_task2(void *param)
     while(1)
     {
         printf("Task 2: Running...\n");
-        lock_acquire(&lock);
+        ulock_acquire(&lock);
         printf("Task 2 got lock\n");
-        lock_free(&lock);
+        ulock_release(&lock);
         sleep(13);
     }
     task_exit();
@@ -69,9 +78,9 @@ void user_task3(void *param)
     while(1)
     {
         printf("Task 3: Running...\n");
-        lock_acquire(&lock);
+        ulock_acquire(&lock);
         printf("Task 3 got lock\n");
-        lock_free(&lock);
+        ulock_release(&lock);
         sleep(17);
     }
     task_exit();
@@ -80,7 +89,12 @@ void user_task3(void *param)
 /* 创建所有用户任务函数 */
 void user_init()
 {
-    task_create(user_task1, NULL, 100, 5);
-    task_create(user_task2, NULL, 105, 10);
-    task_create(user_task3, NULL, 110, 10);
+    ulock_init(&lock);
+#ifdef CONFIG_BENCH
+    task_create(sched_bench, NULL, 0, 10, 0);
+    task_create(lock_bench, NULL, 1, 10, 0);
+#endif
+    task_create(user_task1, NULL, 100, 5, 0);
+    task_create(user_task2, NULL, 105, 10, TASK_STACK_SIZE);
+    task_create(user_task3, NULL, 110, 10, TASK_STACK_SIZE);
 }
\ No newline at end of file
@@ -2,11 +2,28 @@
 #define __USER_API_H__
 
 #include "type.h"
+#include "page.h"
+#include "syscall.h"
+
+/*
+ * 用户态的互斥锁,0为空闲,1为被持有,2为被持有且可能有任务在内核中等待
+ * 没有竞争时获取和释放都只需要一条amoswap,不进入内核;只有需要睡眠或者唤醒等待者时才调用futex
+ */
+typedef struct ulock
+{
+    volatile uint32_t val;
+} ulock_t;
 
 #ifdef RV32
 extern int sleep(uint32_t tick);
 #else
 extern int sleep(uint64_t tick);
 #endif
+extern int sleep_ns(uint64_t ns);
+extern int heap_stats(struct heap_stats *stats);
+extern int futex(volatile uint32_t *addr, int op, uint32_t val);
+extern void ulock_init(ulock_t *lock);
+extern void ulock_acquire(ulock_t *lock);
+extern void ulock_release(ulock_t *lock);
 
 #endif
\ No newline at end of file